@@ -0,0 +1,254 @@
+// Benchmarks for isq_ui.h that don't need a window.
+// Glyphs are faked with fixed size quads, and the
+// render function only counts vertices.
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+typedef struct {
+	float x0, y0, s0, t0;
+	float x1, y1, s1, t1;
+} bench_quad;
+
+static void bench_baked_quad(float *x, float *y, bench_quad *q)
+{
+	q->x0 = *x;
+	q->y0 = *y - 12;
+	q->x1 = *x + 8;
+	q->y1 = *y + 4;
+	q->s0 = q->t0 = 0;
+	q->s1 = q->t1 = 1;
+	*x += 9;
+}
+
+static unsigned long long bench_vertex_count = 0;
+
+#define ISQ_UI_BAKED_QUAD_TYPE bench_quad
+#define ISQ_UI_BAKED_QUAD(data, w, h, c, x, y, q, fill) bench_baked_quad(x, y, q)
+#define ISQ_UI_RENDER_RECT(buffer, count) (bench_vertex_count += (count))
+#define ISQ_UI_IMPLEMENTATION
+#include "isq_ui.h"
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// One frame of a flat list: a single parent with
+// count children.
+static void bench_flat_list(unsigned count)
+{
+	isq_ui_begin(0, 0, 0, 0);
+
+	unsigned id = isq_ui_flexbox(ISQ_UI_BOX_FLAG_FLEX_COLUMN | ISQ_UI_BOX_FLAG_FLEX_NOWRAP).id;
+	isq_ui_position(id, 0, 0);
+	isq_ui_size(id, 1000, 1000);
+
+	for (unsigned i = 0; i < count; ++i) {
+		id = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND).id;
+		isq_ui_size(id, 100, 20);
+	}
+
+	isq_ui_end();
+}
+
+// A list of rows that each hold one child, so
+// every other box is the first child of its
+// parent.
+static void bench_rows(unsigned count)
+{
+	isq_ui_begin(0, 0, 0, 0);
+
+	unsigned id = isq_ui_flexbox(ISQ_UI_BOX_FLAG_FLEX_COLUMN | ISQ_UI_BOX_FLAG_FLEX_NOWRAP).id;
+	isq_ui_position(id, 0, 0);
+	isq_ui_size(id, 1000, 1000);
+
+	for (unsigned i = 0; i < count / 2; ++i) {
+		id = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND).id;
+		isq_ui_size(id, 100, 20);
+
+		isq_ui_push();
+		id = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND).id;
+		isq_ui_size(id, 50, 10);
+		isq_ui_pop();
+	}
+
+	isq_ui_end();
+}
+
+// A wrapping grid of hoverable, clickable cells
+// laid out in deferred mode.
+static void bench_grid(unsigned count)
+{
+	isq_ui_layout_mode(ISQ_UI_LAYOUT_DEFERRED);
+	isq_ui_begin(500, 500, 1, 0);
+
+	unsigned id = isq_ui_flexbox(ISQ_UI_BOX_FLAG_FLEX_ROW).id;
+	isq_ui_position(id, 0, 0);
+	isq_ui_size(id, 1920, 1080);
+
+	for (unsigned i = 0; i < count; ++i) {
+		id = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND | ISQ_UI_BOX_FLAG_HOVERABLE | ISQ_UI_BOX_FLAG_CLICKABLE).id;
+		isq_ui_size(id, 20, 20);
+	}
+
+	isq_ui_end();
+	isq_ui_layout_mode(ISQ_UI_LAYOUT_IMMEDIATE);
+}
+
+// A row of dock panels, each a wrapping grid of
+// count / 8 cells. Built with ISQ_UI_THREADS the
+// panels are laid out in parallel.
+static void bench_docks(unsigned count)
+{
+#ifdef ISQ_UI_THREADS
+	isq_ui_layout_mode(ISQ_UI_LAYOUT_PARALLEL);
+#else
+	isq_ui_layout_mode(ISQ_UI_LAYOUT_DEFERRED);
+#endif
+	isq_ui_begin(500, 500, 0, 0);
+
+	unsigned id = isq_ui_flexbox(ISQ_UI_BOX_FLAG_FLEX_ROW | ISQ_UI_BOX_FLAG_FLEX_NOWRAP).id;
+	isq_ui_position(id, 0, 0);
+	isq_ui_size(id, 1920, 1080);
+
+	for (unsigned panel = 0; panel < 8; ++panel) {
+		id = isq_ui_flexbox(ISQ_UI_BOX_FLAG_FLEX_ROW).id;
+		isq_ui_size(id, 240, 1080);
+
+		for (unsigned i = 0; i < count / 8; ++i) {
+			id = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND).id;
+			isq_ui_size(id, 10, 10);
+		}
+		isq_ui_pop();
+	}
+	isq_ui_pop();
+
+	isq_ui_end();
+	isq_ui_layout_mode(ISQ_UI_LAYOUT_IMMEDIATE);
+}
+
+// Rows of text labels that repeat every 8 rows,
+// laid out in deferred mode with each row marked
+// as a layout template.
+static void bench_text_rows(unsigned count)
+{
+	static const char *labels[] = { "Name", "Size", "Modified", "Type", "Owner", "Group", "Permissions", "Path" };
+
+	isq_ui_layout_mode(ISQ_UI_LAYOUT_DEFERRED);
+	isq_ui_begin(0, 0, 0, 0);
+
+	unsigned id = isq_ui_flexbox(ISQ_UI_BOX_FLAG_FLEX_COLUMN | ISQ_UI_BOX_FLAG_FLEX_NOWRAP).id;
+	isq_ui_position(id, 0, 0);
+	isq_ui_size(id, 1000, 1000);
+
+	for (unsigned i = 0; i < count / 5; ++i) {
+		id = isq_ui_flexbox(ISQ_UI_BOX_FLAG_FLEX_ROW).id;
+		isq_ui_position(id, 0, 0);
+		isq_ui_size(id, 1000, 20);
+		isq_ui_layout_template(id, isq_ui_key_int(i % 8));
+
+		for (unsigned j = 0; j < 4; ++j) {
+			id = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_TEXT).id;
+			isq_ui_text(id, labels[(i + j) % 8]);
+			isq_ui_semantic_size(id, (union isq_ui_sizes){ .x = { .type = ISQ_UI_SIZE_TYPE_TEXT_CONTENT }, .y = { .type = ISQ_UI_SIZE_TYPE_TEXT_CONTENT } });
+		}
+		isq_ui_pop();
+	}
+
+	isq_ui_end();
+	isq_ui_layout_mode(ISQ_UI_LAYOUT_IMMEDIATE);
+}
+
+// Rows differ in width and shade, so scrolling
+// changes what is drawn.
+static void bench_list_row(unsigned row, unsigned id, void *user)
+{
+	(void)id;
+	(void)user;
+
+	unsigned label = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND).id;
+	isq_ui_size(label, 100 + (float)(row % 7) * 20, 16);
+	isq_ui_background_color(label, 0.2f, 0.2f, row % 2 ? 0.3f : 0.4f, 1);
+}
+
+// A virtual list with count rows, scrolled a bit
+// further every frame. Frame time should not
+// depend on count.
+static void bench_virtual_list(unsigned count)
+{
+	isq_ui_begin(0, 0, 0, -1);
+
+	unsigned id = isq_ui_create_keyed(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND | ISQ_UI_BOX_FLAG_SCROLL_VERTICAL, isq_ui_key_string("list")).id;
+	isq_ui_position(id, 0, 0);
+	isq_ui_size(id, 400, 1000);
+	isq_ui_virtual_list(id, count, 20, bench_list_row, NULL);
+
+	isq_ui_end();
+}
+
+static struct isq_ui_log bench_log;
+
+// A log view following the end of a log that
+// grows by count / 1000 lines every frame. Frame
+// time should not depend on how long the log is.
+static void bench_log_view(unsigned count)
+{
+	char line[64];
+	for (unsigned i = 0; i < count / 1000; ++i) {
+		int length = snprintf(line, sizeof(line), "[%u] request handled in %u us\n", bench_log.line_count, i * 7 % 1000);
+		isq_ui_log_append(&bench_log, line, (unsigned)length);
+	}
+
+	isq_ui_begin(0, 0, 0, 0);
+
+	unsigned id = isq_ui_create_keyed(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND, isq_ui_key_string("log")).id;
+	isq_ui_position(id, 0, 0);
+	isq_ui_size(id, 1000, 1000);
+	isq_ui_log_view(id, &bench_log);
+
+	isq_ui_end();
+}
+
+static void bench_run(const char *name, void (*frame)(unsigned), unsigned count, unsigned frames)
+{
+	// Warm up, so buffers have grown to size.
+	frame(count);
+
+	double start = bench_now();
+	for (unsigned i = 0; i < frames; ++i)
+		frame(count);
+	double elapsed = bench_now() - start;
+
+	printf("%-12s %8u boxes: %9.3f ms/frame %7.1f ns/box\n", name, count, elapsed * 1e3 / frames, elapsed * 1e9 / frames / count);
+}
+
+int main(void)
+{
+	struct isq_ui_style style = {0};
+	style.box.font.size = 16;
+	isq_ui_init(1920, 1080, &style);
+
+	bench_run("flat list", bench_flat_list, 1000, 100);
+	bench_run("flat list", bench_flat_list, 10000, 20);
+	bench_run("flat list", bench_flat_list, 100000, 5);
+	bench_run("rows", bench_rows, 1000, 100);
+	bench_run("rows", bench_rows, 10000, 20);
+	bench_run("rows", bench_rows, 100000, 5);
+	bench_run("grid", bench_grid, 1000, 100);
+	bench_run("grid", bench_grid, 10000, 20);
+	bench_run("grid", bench_grid, 100000, 5);
+	bench_run("text rows", bench_text_rows, 1000, 100);
+	bench_run("text rows", bench_text_rows, 10000, 20);
+	bench_run("text rows", bench_text_rows, 100000, 5);
+	bench_run("virtual", bench_virtual_list, 1000, 100);
+	bench_run("virtual", bench_virtual_list, 1000000, 100);
+	bench_run("log", bench_log_view, 1000, 100);
+	bench_run("log", bench_log_view, 1000000, 100);
+	bench_run("docks", bench_docks, 20000, 20);
+	bench_run("docks", bench_docks, 100000, 5);
+
+	return 0;
+}
@@ -1 +1,4 @@
+REM main.c needs GLFW, glad/glad.h and stb_truetype.h (https://github.com/nothings/stb) in W:\include.
 CL /Zi /MD main.c glad.c /I W:\\include /link W:\\lib\\glfw3.lib gdi32.lib user32.lib kernel32.lib shell32.lib
+CL /O2 bench.c
+CL test.c
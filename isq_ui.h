@@ -1,11 +1,25 @@
 // Usage:
 // ISQ_UI_RENDER_RECT(buffer, count)
+// or
+// ISQ_UI_RENDER_COMMANDS(commands, command_count, buffer, count)
 // must be defined by the user.
-// buffer: pointer to an array of rects
-// count: number of rects in the array
-// rect:
-//   vec4 min, max;
-//   vec4 color;
+// buffer: pointer to an array of
+// struct isq_ui_vertex, 4 per rect, or with
+// ISQ_UI_INSTANCES of struct isq_ui_instance, 1
+// per rect.
+// count: number of elements in the array
+// commands: pointer to an array of
+// struct isq_ui_command, which split the rects
+// into runs drawn with the same clip rect.
+// Nothing is clipped on the CPU, so
+// ISQ_UI_RENDER_RECT draws boxes that are
+// partly scrolled out of view unclipped.
+//
+// ISQ_UI_MAP_VERTICES(count) can also be defined
+// to return memory for count elements, such as a
+// mapped region of a GPU buffer, or NULL. The
+// final pass over the buffer writes into it, and
+// it is what the render macro is given.
 
 
 // This will set the amount of ui elements
@@ -20,6 +34,126 @@
 #define ISQ_UI_INITIAL_BUFFER_CAPACITY 32
 #endif
 
+// Keyed boxes that were not created for this
+// many frames have their retained state thrown
+// away.
+#ifndef ISQ_UI_RETAINED_FRAMES
+#define ISQ_UI_RETAINED_FRAMES 2
+#endif
+
+// Number of layouts remembered per keyed box.
+// Setters lay a box out again each time they
+// are called, so this should cover the number
+// of layout setters called on one box.
+#ifndef ISQ_UI_LAYOUT_HISTORY
+#define ISQ_UI_LAYOUT_HISTORY 4
+#endif
+
+// Define ISQ_UI_THREADS to build in the thread
+// pool used by ISQ_UI_LAYOUT_PARALLEL. Uses
+// win32 threads on Windows, pthreads elsewhere.
+// ISQ_UI_BAKED_QUAD must be safe to call from
+// several threads at once when it is used.
+#ifndef ISQ_UI_LAYOUT_THREADS
+#define ISQ_UI_LAYOUT_THREADS 4
+#endif
+
+// Subtrees with fewer boxes than this are laid
+// out by the thread that found them instead of
+// being handed to the pool.
+#ifndef ISQ_UI_PARALLEL_LAYOUT_THRESHOLD
+#define ISQ_UI_PARALLEL_LAYOUT_THRESHOLD 1024
+#endif
+
+// Number of entries in the cache of resolved
+// text content sizes. Must be a power of 2.
+#ifndef ISQ_UI_SIZE_CACHE_SIZE
+#define ISQ_UI_SIZE_CACHE_SIZE 1024
+#endif
+
+// Number of entries in the cache of measured
+// strings. Must be a power of 2.
+#ifndef ISQ_UI_TEXT_MEASURE_CACHE_SIZE
+#define ISQ_UI_TEXT_MEASURE_CACHE_SIZE 4096
+#endif
+
+// Number of texts, and separately paragraphs,
+// whose word wrapped lines are remembered. Must
+// be a power of 2.
+#ifndef ISQ_UI_WRAP_CACHE_SIZE
+#define ISQ_UI_WRAP_CACHE_SIZE 1024
+#endif
+
+// Bytes per chunk of an isq_ui_log. Lines longer
+// than this get a chunk of their own.
+#ifndef ISQ_UI_LOG_CHUNK_SIZE
+#define ISQ_UI_LOG_CHUNK_SIZE (1 << 16)
+#endif
+
+// Number of layout templates remembered. See
+// isq_ui_layout_template. Must be a power of 2.
+#ifndef ISQ_UI_TEMPLATE_CACHE_SIZE
+#define ISQ_UI_TEMPLATE_CACHE_SIZE 64
+#endif
+
+// Bytes of glyph quads kept for text that was
+// drawn before. The least recently drawn text is
+// dropped first.
+#ifndef ISQ_UI_GLYPH_CACHE_BYTES
+#define ISQ_UI_GLYPH_CACHE_BYTES (1 << 20)
+#endif
+
+// Size of the bitmap fonts without an atlas were
+// baked into, passed on to ISQ_UI_BAKED_QUAD.
+#ifndef ISQ_UI_BAKED_WIDTH
+#define ISQ_UI_BAKED_WIDTH 512
+#endif
+#ifndef ISQ_UI_BAKED_HEIGHT
+#define ISQ_UI_BAKED_HEIGHT 512
+#endif
+
+// Define ISQ_UI_COMPACT_VERTICES to get 16 byte
+// struct isq_ui_compact_vertex instead of 40 byte
+// struct isq_ui_vertex. Positions are stored in
+// units of 1 / ISQ_UI_COMPACT_SUBPIXELS pixels,
+// which must keep them within +-32767.
+#ifndef ISQ_UI_COMPACT_SUBPIXELS
+#define ISQ_UI_COMPACT_SUBPIXELS 4
+#endif
+
+// Define ISQ_UI_UNCHANGED_FRAMES to hash what
+// would be rendered each frame, and skip the
+// render macro when it is the same as last frame.
+// See isq_ui_frame_unchanged.
+
+// Define ISQ_UI_DIRTY_RANGES to compare the
+// buffer given to the render macros with last
+// frame's, this many bytes at a time, and report
+// the ranges that changed through
+// isq_ui_dirty_ranges.
+#ifndef ISQ_UI_DIRTY_CHUNK_SIZE
+#define ISQ_UI_DIRTY_CHUNK_SIZE 4096
+#endif
+
+// Draw commands are moved back past up to this
+// many others they don't overlap, to join an
+// earlier command with the same clip and texture.
+// 0 keeps them in drawing order.
+#ifndef ISQ_UI_BATCH_LOOKBACK
+#define ISQ_UI_BATCH_LOOKBACK 16
+#endif
+
+// Size in pixels of the cells of the grid used to
+// find the box under the mouse.
+#ifndef ISQ_UI_HIT_GRID_CELL_SIZE
+#define ISQ_UI_HIT_GRID_CELL_SIZE 64
+#endif
+
+// Maximum depth of isq_ui_push_key.
+#ifndef ISQ_UI_KEY_STACK_SIZE
+#define ISQ_UI_KEY_STACK_SIZE 64
+#endif
+
 // Override the default printf by using this
 // macro.
 #ifndef ISQ_PRINTF
@@ -32,6 +166,16 @@
 #define ISQ_STRLEN(s) strlen(s)
 #endif
 
+// Can provide alternatives to the math functions
+// used by defining the following macros. The
+// defaults are plain C, so nothing needs -lm.
+#ifndef ISQ_SQRTF
+#define ISQ_SQRTF(x) isq_ui_sqrtf(x)
+#define ISQ_FLOORF(x) isq_ui_floorf(x)
+#define ISQ_LRINTF(x) isq_ui_lrintf(x)
+#define ISQ_UI_DEFAULT_MATH
+#endif
+
 // Can provide alternatives to malloc and free
 // by defining the following macros:
 #ifndef ISQ_MALLOC
@@ -90,6 +234,38 @@ enum isq_ui_size_type {
 	ISQ_UI_SIZE_TYPE_PIXELS,
 	ISQ_UI_SIZE_TYPE_PERCENT,
 	ISQ_UI_SIZE_TYPE_TEXT_CONTENT,
+	// Fits the children that have a size of their
+	// own (not PERCENT). Only resolved in
+	// ISQ_UI_LAYOUT_DEFERRED mode.
+	ISQ_UI_SIZE_TYPE_CHILDREN_SUM,
+};
+
+enum isq_ui_layout_mode {
+	// Setters lay the box out as soon as they are
+	// called. Default.
+	ISQ_UI_LAYOUT_IMMEDIATE,
+	// Setters only record properties, and all boxes
+	// are laid out once in isq_ui_end. Rects read
+	// with isq_ui_get_size and isq_ui_get_position
+	// while building are from the previous frame.
+	ISQ_UI_LAYOUT_DEFERRED,
+	// Same as ISQ_UI_LAYOUT_DEFERRED, but subtrees
+	// of at least ISQ_UI_PARALLEL_LAYOUT_THRESHOLD
+	// boxes are laid out on a pool of
+	// ISQ_UI_LAYOUT_THREADS threads (the calling
+	// thread included). Without ISQ_UI_THREADS
+	// this is the same as ISQ_UI_LAYOUT_DEFERRED.
+	ISQ_UI_LAYOUT_PARALLEL,
+};
+
+enum isq_ui_interaction_mode {
+	// Boxes are hit tested when created, against
+	// the rects drawn last frame. Default.
+	ISQ_UI_INTERACTION_IMMEDIATE,
+	// Also hit tests the final rects in isq_ui_end,
+	// calls the callbacks set with isq_ui_on_interact
+	// and records the result for isq_ui_state_of.
+	ISQ_UI_INTERACTION_DEFERRED,
 };
 
 struct isq_ui_size {
@@ -111,16 +287,78 @@ struct isq_ui_vertex {
 	isq_vec4 color;
 };
 
+// With ISQ_UI_INSTANCES defined, the buffer given
+// to the render macros holds one of these per rect
+// instead of 4 vertices, and the backend expands
+// them in its vertex shader. 32 bytes, against 160
+// for 4 vertices.
+struct isq_ui_instance {
+	// x0, y0, x1, y1 in pixels.
+	isq_vec4 rect;
+	// u0, v0, u1, v1 as unorm16.
+	unsigned short uvs[4];
+	// RGBA8.
+	unsigned char color[4];
+	unsigned texture_index;
+};
+
+// With ISQ_UI_COMPACT_VERTICES defined, vertices
+// are quantized to 16 bytes: x and y in units of
+// 1 / ISQ_UI_COMPACT_SUBPIXELS pixels, unorm16
+// UVs, RGBA8 color and an 8 bit texture index.
+struct isq_ui_compact_vertex {
+	short position[2];
+	unsigned short uvs[2];
+	unsigned char color[4];
+	unsigned char texture_index;
+	unsigned char padding[3];
+};
+
+// Vertices, or instances, [first, first + count)
+// all use texture_index and are clipped to clip
+// (x0, y0, x1, y1 in pixels). Backends apply it
+// with a scissor rect or an equivalent.
+struct isq_ui_command {
+	isq_vec4 clip;
+	unsigned texture_index;
+	unsigned first;
+	unsigned count;
+};
+
+// Identifies a box across frames, independent
+// of the order boxes are created in.
+// 0 is never a valid key.
+typedef unsigned long long isq_ui_key;
+
 struct isq_ui_state {
 	unsigned id;
+	isq_ui_key key;
 	unsigned char clicked;
 	unsigned char hovered;
 };
 
+// Called from isq_ui_end for the box under the
+// mouse, in ISQ_UI_INTERACTION_DEFERRED mode.
+typedef void (*isq_ui_interact_callback)(struct isq_ui_state state, void *user);
+
+// Maps Unicode codepoints to indices into a
+// font's character data, in pages of 256
+// codepoints that are only allocated when a range
+// is added to them. Zero initialize before use.
+struct isq_ui_glyph_table {
+	unsigned *pages[0x110000 >> 8];
+};
+
 struct isq_ui_font {
 	void *character_data;
 	unsigned texture_index;
 	unsigned size;
+	// NULL maps ' ' to '~' to glyphs 0 to 94, like
+	// stbtt_BakeFontBitmap with first_char 32.
+	struct isq_ui_glyph_table *glyphs;
+	// Rasterize glyphs on demand instead, with
+	// character_data passed to the atlas callback.
+	struct isq_ui_atlas *atlas;
 };
 
 // Copy of stbtt_aligned_quad.
@@ -148,20 +386,125 @@ struct isq_ui_style {
 	struct isq_ui_box_style button;
 };
 
+// Counters for the current frame. Reset by
+// isq_ui_begin.
+struct isq_ui_stats {
+	// Keyed boxes whose layout inputs matched a
+	// previous layout reuse its result instead of
+	// being computed again.
+	unsigned layout_computed;
+	unsigned layout_reused;
+	// Lookups of text content sizes in the size
+	// cache.
+	unsigned size_cache_hits;
+	unsigned size_cache_misses;
+	// Boxes with a layout template whose children
+	// were placed from the template cache, or laid
+	// out and stored in it.
+	unsigned template_hits;
+	unsigned template_misses;
+	// Keyed boxes in deferred layout whose
+	// descendants were restored from their last
+	// layout because nothing in the subtree
+	// changed, or had to be laid out again.
+	unsigned subtree_hits;
+	unsigned subtree_misses;
+	// Lookups of the box under the mouse, which
+	// are skipped when neither the mouse nor the
+	// boxes moved, and boxes moved in the hit test
+	// grid by isq_ui_end.
+	unsigned hit_lookups;
+	unsigned hit_grid_updates;
+	// Text boxes drawn from the glyph run cache,
+	// or with ISQ_UI_BAKED_QUAD.
+	unsigned glyph_cache_hits;
+	unsigned glyph_cache_misses;
+	// Lookups of strings in the text measurement
+	// cache, including isq_ui_warm_text.
+	unsigned text_measure_hits;
+	unsigned text_measure_misses;
+	// Lookups of word wrapped text, and paragraphs
+	// that had to be wrapped again because their
+	// text or the wrap width changed.
+	unsigned wrap_hits;
+	unsigned wrap_misses;
+	unsigned wrap_paragraphs;
+	// Draw commands given to
+	// ISQ_UI_RENDER_COMMANDS, and runs of rects that
+	// were merged into an earlier command.
+	unsigned draw_batches;
+	unsigned draw_batches_merged;
+	// Bytes of the render buffer that changed since
+	// last frame, with ISQ_UI_DIRTY_RANGES.
+	unsigned dirty_bytes;
+};
+
+// size bytes at offset into the buffer given to
+// the render macros.
+struct isq_ui_dirty_range {
+	unsigned offset;
+	unsigned size;
+};
+
+// Size of a string drawn in a font. width is the
+// string drawn on one line, max_line_width the
+// widest of its lines when split at '\n'.
+struct isq_ui_text_metrics {
+	float width;
+	float max_line_width;
+	unsigned line_count;
+};
+
 // Call ONCE before using anything.
 // width and height are the dimensions of the UI
 // area - typically the window.
 void isq_ui_init(float width, float height, struct isq_ui_style *style);
 
+void isq_ui_layout_mode(enum isq_ui_layout_mode mode);
+void isq_ui_interaction_mode(enum isq_ui_interaction_mode mode);
+
 // Call once per frame before using the functions
 // in this header.
 void isq_ui_begin(float mouse_x, float mouse_y, int left_down, float scroll_delta);
 // Call after using the functions in this header.
 void isq_ui_end(void);
+// With ISQ_UI_UNCHANGED_FRAMES defined, returns 1
+// if the last isq_ui_end would have rendered the
+// same as the frame before it, in which case the
+// render macro was not called and the previous
+// image can be presented again.
+int isq_ui_frame_unchanged(void);
 
 // Returns id.
 struct isq_ui_state isq_ui_create(enum isq_ui_box_flags flags);
 
+// Same as isq_ui_create, but the box keeps its
+// state (scroll offset, last frame's rect) under
+// key, so it follows the box when the boxes
+// around it come and go. The key is combined
+// with the key stack. If a key is used twice in
+// a frame, the second box is left unkeyed.
+struct isq_ui_state isq_ui_create_keyed(enum isq_ui_box_flags flags, isq_ui_key key);
+
+// Make a key from a string or an integer, e.g.
+// a row index or a pointer to the row's data.
+isq_ui_key isq_ui_key_string(const char *string);
+isq_ui_key isq_ui_key_int(unsigned long long value);
+
+// Scope keys created until the matching pop
+// under key, so that the same strings can be
+// reused in different lists.
+unsigned isq_ui_push_key(isq_ui_key key);
+unsigned isq_ui_pop_key(void);
+
+// State of the keyed box as resolved by the last
+// isq_ui_end in ISQ_UI_INTERACTION_DEFERRED mode,
+// so after isq_ui_end it describes this frame.
+// key is combined with the key stack the same
+// way as in isq_ui_create_keyed. Unknown keys
+// return an id of (unsigned)-1.
+struct isq_ui_state isq_ui_state_of(isq_ui_key key);
+
 // Set the current parent on the stack.
 unsigned isq_ui_push_id(unsigned id);
 // Set the current parent to the last created
@@ -182,6 +525,8 @@ unsigned isq_ui_border(unsigned id, float r, float g, float b, float a, float wi
 unsigned isq_ui_padding(unsigned id, float top, float right, float bottom, float left);
 unsigned isq_ui_parent(unsigned id, unsigned parent_id);
 unsigned isq_ui_font(unsigned id, void *character_data, unsigned size, unsigned texture_index);
+unsigned isq_ui_font_glyphs(unsigned id, struct isq_ui_glyph_table *glyphs);
+unsigned isq_ui_font_atlas(unsigned id, struct isq_ui_atlas *atlas);
 unsigned isq_ui_text_color(unsigned id, float r, float g, float b, float a);
 
 // Set size in pixels.
@@ -193,6 +538,38 @@ void isq_ui_get_position(unsigned id, float *x, float *y);
 
 unsigned isq_ui_last_id(void);
 
+// Marks the box as an instance of a repeated
+// subtree, like a list row. In deferred layout,
+// boxes with the same key, size and number of
+// descendants reuse the child layout of the first
+// one, moved to their own position. The key has
+// to cover anything else that changes the
+// children, such as their text.
+unsigned isq_ui_layout_template(unsigned id, isq_ui_key key);
+
+// Call callback from isq_ui_end this frame if the
+// box ends up hovered or clicked. Only used in
+// ISQ_UI_INTERACTION_DEFERRED mode.
+unsigned isq_ui_on_interact(unsigned id, isq_ui_interact_callback callback, void *user);
+
+void isq_ui_get_stats(struct isq_ui_stats *stats);
+
+// With ISQ_UI_DIRTY_RANGES defined, the ranges of
+// this frame's render buffer that differ from last
+// frame's, in order. Call it from the render
+// macro. A backend that uploads these every frame
+// keeps its copy of the buffer up to date.
+const struct isq_ui_dirty_range *isq_ui_dirty_ranges(unsigned *count);
+
+// Measure text in font. Results are cached by the
+// font and the bytes of the string.
+struct isq_ui_text_metrics isq_ui_measure_text(struct isq_ui_font font, const char *text);
+
+// Measure count strings ahead of time, for
+// example while loading, so the first frame that
+// shows them doesn't have to.
+void isq_ui_warm_text(struct isq_ui_font font, const char **texts, unsigned count);
+
 // Flexbox is a layer built on top of isq_ui_box
 // that allows you to define a flexible
 // layout. It's based on CSS's flexbox.
@@ -213,14 +590,175 @@ struct isq_ui_state isq_ui_button(const char *text);
 // Scrolls vertically if the text is too long.
 struct isq_ui_state isq_ui_text_display(const char *text);
 
+// Called by isq_ui_virtual_list for each visible
+// row, with the row's box pushed as the current
+// parent. The row is row_height tall and as wide
+// as the list, but the callback can resize it.
+typedef void (*isq_ui_row_callback)(unsigned row, unsigned id, void *user);
+
+// Turns box id into a vertically scrolling list
+// of row_count rows, and creates boxes only for
+// the rows that are visible. Rows are stacked in
+// a column starting at row * row_height, so if
+// rows set their own height, row_height is the
+// estimate used for the rows scrolled past.
+// id should be keyed, so that its scroll offset
+// and size are known before layout.
+unsigned isq_ui_virtual_list(unsigned id, unsigned row_count, float row_height, isq_ui_row_callback callback, void *user);
+
+struct isq_ui_log_chunk {
+	char *data;
+	unsigned size;
+	unsigned used;
+};
+
+// Start of a line, which is NUL-terminated
+// inside its chunk.
+struct isq_ui_log_line {
+	unsigned chunk;
+	unsigned offset;
+};
+
+// Append-only text for isq_ui_log_view, such as a
+// live server log. Text is stored in chunks that
+// never move, with an index of where each line
+// starts. Zero initialize before use.
+struct isq_ui_log {
+	struct isq_ui_log_chunk *chunks;
+	unsigned chunk_count;
+	unsigned chunk_capacity;
+	struct isq_ui_log_line *lines;
+	unsigned line_count;
+	unsigned line_capacity;
+	// The last line hasn't seen its '\n' yet.
+	int line_open;
+};
+
+// Append length bytes of text. Costs the same no
+// matter how long the log already is.
+void isq_ui_log_append(struct isq_ui_log *log, const char *text, unsigned length);
+const char *isq_ui_log_line(const struct isq_ui_log *log, unsigned line);
+void isq_ui_log_free(struct isq_ui_log *log);
+
+// Turns box id into a virtual list of the lines of
+// log, one font size tall each. Follows the end of
+// the log until the user scrolls up. id should be
+// keyed, see isq_ui_virtual_list.
+unsigned isq_ui_log_view(unsigned id, struct isq_ui_log *log);
+
+// Map count codepoints starting at first_codepoint
+// to the glyphs starting at first_glyph, for
+// example one range of stbtt_PackFontRanges.
+unsigned isq_ui_glyph_table_add(struct isq_ui_glyph_table *table, unsigned first_codepoint, unsigned count, unsigned first_glyph);
+void isq_ui_glyph_table_free(struct isq_ui_glyph_table *table);
+
+struct isq_ui_glyph_metrics {
+	int width;
+	int height;
+	// From the pen position to the top left of the
+	// bitmap, y down.
+	float x_offset;
+	float y_offset;
+	float advance;
+};
+
+// Fill in the metrics of codepoint in font at size
+// and, if pixels isn't NULL, rasterize it there as
+// width x height 8 bit coverage, stride bytes per
+// row. stbtt_GetCodepointBitmapBox and
+// stbtt_MakeCodepointBitmap fit this directly.
+typedef void (*isq_ui_rasterize_callback)(void *font, unsigned codepoint, float size, struct isq_ui_glyph_metrics *metrics, unsigned char *pixels, int stride, void *user);
+
+struct isq_ui_atlas_node {
+	unsigned x;
+	unsigned y;
+	unsigned width;
+};
+
+// One page_size x page_size single channel
+// texture, filled bottom up along a skyline.
+struct isq_ui_atlas_page {
+	unsigned char *pixels;
+	struct isq_ui_atlas_node *nodes;
+	unsigned node_count;
+	unsigned last_used;
+	// x0, y0, x1, y1 of the texels changed since
+	// isq_ui_atlas_dirty last returned them.
+	unsigned dirty[4];
+};
+
+struct isq_ui_atlas_glyph {
+	isq_ui_key key;
+	// ISQ_UI_GLYPH_NONE if the glyph has no pixels.
+	unsigned page;
+	unsigned x;
+	unsigned y;
+	int width;
+	int height;
+	float x_offset;
+	float y_offset;
+	float advance;
+};
+
+// Glyphs of any number of fonts and sizes,
+// rasterized the first time they are drawn. Page n
+// is drawn with texture index first_texture_index
+// + n. When every page is full, the least recently
+// used one is cleared and its glyphs are
+// rasterized again when next needed.
+struct isq_ui_atlas {
+	unsigned page_size;
+	unsigned max_pages;
+	unsigned first_texture_index;
+	isq_ui_rasterize_callback rasterize;
+	void *user;
+	// Set by isq_ui_atlas_sdf.
+	float sdf_size;
+	unsigned sdf_spread;
+
+	struct isq_ui_atlas_page *pages;
+	unsigned page_count;
+	unsigned evictions;
+	// Glyphs that didn't fit, which are tried again
+	// the next time they are drawn.
+	unsigned place_failures;
+
+	struct isq_ui_atlas_glyph *glyphs;
+	unsigned glyph_count;
+	unsigned glyph_capacity;
+	// Open addressing over glyphs, index + 1.
+	unsigned *slots;
+	unsigned slot_capacity;
+};
+
+// max_pages is at most 32.
+unsigned isq_ui_atlas_init(struct isq_ui_atlas *atlas, unsigned page_size, unsigned max_pages, unsigned first_texture_index, isq_ui_rasterize_callback rasterize, void *user);
+void isq_ui_atlas_free(struct isq_ui_atlas *atlas);
+
+// Store signed distance fields instead of
+// coverage. Every glyph is rasterized once at
+// reference_size and scaled to the size of the
+// font it is drawn with, so one atlas serves all
+// sizes. spread is the distance in texels the
+// field reaches past the outline. Draw the pages
+// with a shader like rect_sdf.frag. Call before
+// the atlas is first used.
+unsigned isq_ui_atlas_sdf(struct isq_ui_atlas *atlas, float reference_size, unsigned spread);
+
+// Returns 1 and the rect (x0, y0, x1, y1) of page
+// that changed since the last call, or 0 if it
+// didn't. The backend uploads only those texels,
+// a row of pixels is page_size bytes.
+int isq_ui_atlas_dirty(struct isq_ui_atlas *atlas, unsigned page, unsigned rect[4]);
+
 #endif
 
 // Implementation section.
 //#define ISQ_UI_IMPLEMENTATION
 #ifdef ISQ_UI_IMPLEMENTATION
 
-#ifndef ISQ_UI_RENDER_RECT
-#error "ISQ_UI_RENDER_RECT must be defined"
+#if !defined(ISQ_UI_RENDER_RECT) && !defined(ISQ_UI_RENDER_COMMANDS)
+#error "ISQ_UI_RENDER_RECT or ISQ_UI_RENDER_COMMANDS must be defined"
 #endif
 
 /*
@@ -237,36 +775,327 @@ struct isq_ui_state isq_ui_text_display(const char *text);
 #error "ISQ_UI_BAKED_QUAD must be defined"
 #endif
 
+#include <float.h>
+
+#ifdef ISQ_UI_DEFAULT_MATH
+// Only ever given squared distances, which are
+// not negative.
+static float isq_ui_sqrtf(float x)
+{
+	if (!(x > 0) || x > FLT_MAX)
+		return x > 0 ? x : 0;
+
+	// Halving the exponent bits is within a few
+	// percent, and each Newton step squares the
+	// error. Done in double, where no float is
+	// denormal.
+	union { double d; unsigned long long u; } bits = { x };
+	bits.u = (bits.u >> 1) + 0x1ff7a3bea91d9b1bULL;
+
+	double root = bits.d;
+	for (int i = 0; i < 3; ++i)
+		root = 0.5 * (root + x / root);
+
+	return (float)root;
+}
+
+static float isq_ui_floorf(float x)
+{
+	// Floats this large have no fraction.
+	if (!(x > -8388608.0f && x < 8388608.0f))
+		return x;
+
+	float truncated = (float)(int)x;
+	return truncated > x ? truncated - 1 : truncated;
+}
+
+#if defined(ISQ_UI_INSTANCES) || defined(ISQ_UI_COMPACT_VERTICES)
+// Halfway cases go to the even neighbour, like
+// lrintf in the default rounding mode.
+static long isq_ui_lrintf(float x)
+{
+	long rounded = (long)x;
+	float fraction = x - (float)rounded;
+
+	if (fraction > 0.5f || (fraction == 0.5f && (rounded & 1)))
+		++rounded;
+	else if (fraction < -0.5f || (fraction == -0.5f && (rounded & 1)))
+		--rounded;
+
+	return rounded;
+}
+#endif
+#endif
+
+#ifdef ISQ_UI_THREADS
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+typedef CRITICAL_SECTION isq_ui_mutex;
+typedef CONDITION_VARIABLE isq_ui_cond;
+#define isq_ui_mutex_init(m) InitializeCriticalSection(m)
+#define isq_ui_mutex_lock(m) EnterCriticalSection(m)
+#define isq_ui_mutex_unlock(m) LeaveCriticalSection(m)
+#define isq_ui_cond_init(c) InitializeConditionVariable(c)
+#define isq_ui_cond_wait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define isq_ui_cond_broadcast(c) WakeAllConditionVariable(c)
+#define isq_ui_thread_yield() SwitchToThread()
+#define ISQ_UI_ATOMIC_ADD(p, v) (InterlockedExchangeAdd((volatile LONG *)(p), (v)) + (v))
+#define ISQ_UI_ATOMIC_LOAD(p) InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#else
+#include <pthread.h>
+#include <sched.h>
+typedef pthread_mutex_t isq_ui_mutex;
+typedef pthread_cond_t isq_ui_cond;
+#define isq_ui_mutex_init(m) pthread_mutex_init(m, NULL)
+#define isq_ui_mutex_lock(m) pthread_mutex_lock(m)
+#define isq_ui_mutex_unlock(m) pthread_mutex_unlock(m)
+#define isq_ui_cond_init(c) pthread_cond_init(c, NULL)
+#define isq_ui_cond_wait(c, m) pthread_cond_wait(c, m)
+#define isq_ui_cond_broadcast(c) pthread_cond_broadcast(c)
+#define isq_ui_thread_yield() sched_yield()
+#define ISQ_UI_ATOMIC_ADD(p, v) __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#define ISQ_UI_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+#endif
+
+// Culling tests 8 boxes at a time with AVX2, 4
+// with SSE2, and falls back to plain C. Define
+// ISQ_UI_NO_SIMD to always use plain C.
+#ifndef ISQ_UI_NO_SIMD
+#if defined(__AVX2__)
+#define ISQ_UI_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ISQ_UI_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#endif
+
 #define ISQ_UI_MAGIC_NUMBERF (float)0xdeadbeef
 #define ISQ_UI_MAGIC_NUMBERV4 (isq_vec4){ISQ_UI_MAGIC_NUMBERF, ISQ_UI_MAGIC_NUMBERF, ISQ_UI_MAGIC_NUMBERF, ISQ_UI_MAGIC_NUMBERF}
 
+#define ISQ_UI_RETAINED_NONE ((unsigned)-1)
+
+#define ISQ_UI_GLYPH_NONE ((unsigned)-1)
+
+// What the render macros are given per rect.
+#if defined(ISQ_UI_INSTANCES) && defined(ISQ_UI_COMPACT_VERTICES)
+#error "ISQ_UI_INSTANCES and ISQ_UI_COMPACT_VERTICES can't both be defined"
+#elif defined(ISQ_UI_INSTANCES)
+typedef struct isq_ui_instance isq_ui_render_vertex;
+#define ISQ_UI_RECT_VERTICES 1
+#elif defined(ISQ_UI_COMPACT_VERTICES)
+typedef struct isq_ui_compact_vertex isq_ui_render_vertex;
+#define ISQ_UI_RECT_VERTICES 4
+#else
+typedef struct isq_ui_vertex isq_ui_render_vertex;
+#define ISQ_UI_RECT_VERTICES 4
+#endif
+
+// Tree links are indices into isq_ui_box_array
+// so they survive the array growing.
+#define ISQ_UI_ID_NONE ((unsigned)-1)
+
+// The rest of a box lives in the parallel hot
+// arrays (isq_ui_box_flags_array and friends).
+// Fields used by layout come first, style and
+// text last.
 struct isq_ui_box {
 	unsigned id;
+	isq_ui_key key;
+	// Index into isq_ui_retained_array, or
+	// ISQ_UI_RETAINED_NONE for unkeyed boxes.
+	unsigned retained;
 	// Per frame.
-	enum isq_ui_box_flags flags;
-	union isq_ui_sizes semantic_size;
 	isq_vec2 position;
 
-	struct isq_ui_box_style style;
+	unsigned first_child;
+	unsigned next_sibling;
+	unsigned prev_sibling;
+	unsigned last_child;
+
+	// Computed.
+	isq_vec2 children_size;
+	// Number of boxes in the subtree, including
+	// this one. Only counted for deferred layout.
+	unsigned subtree_count;
+	// One past the last box of the subtree, and a
+	// hash of every layout input in it, for boxes
+	// that are keyed or have a keyed ancestor.
+	unsigned subtree_end;
+	isq_ui_key subtree_hash;
+	// Set when a keyed box's subtree was laid out
+	// this frame, for isq_ui_subtree_store.
+	isq_ui_key subtree_key;
+	unsigned char keyed_ancestor;
+	isq_ui_key layout_template;
+
+	float flex_size;
+	unsigned flex_count;
+
+	float scroll_offset;
+	float scroll_offset_max;
+	// Height of the scrolled content, if known.
+	// Otherwise boxes scroll by their own height.
+	float scroll_height;
+	// Computed by isq_ui_render: the sum of the
+	// scroll offsets of the box's ancestors, and
+	// the nearest scrolling one.
+	float scroll_shift;
+	unsigned scroll_parent;
+
+	isq_ui_interact_callback on_interact;
+	void *on_interact_user;
 
 	const char *text;
 	float text_width_in_pixels;
 	unsigned text_line_count;
 
-	struct isq_ui_box *parent;
-	struct isq_ui_box *first_child;
-	struct isq_ui_box *next_sibling;
-	struct isq_ui_box *prev_sibling;
-	struct isq_ui_box *last_child;
+	struct isq_ui_box_style style;
+};
 
-	// Computed.
+// Result of isq_ui_compute_rect for one set of
+// inputs, including its effect on the parent.
+struct isq_ui_layout {
+	isq_ui_key hash;
 	isq_vec4 computed_rect;
+	float scroll_offset_max;
+	float parent_flex_size;
+	unsigned parent_flex_count;
+};
 
-	float flex_size;
-	unsigned flex_count;
+struct isq_ui_size_cache_entry {
+	isq_ui_key key;
+	isq_vec2 size;
+};
+
+// With threads the size cache is split into
+// stripes with a lock each, so that workers
+// rarely wait on each other.
+#ifdef ISQ_UI_THREADS
+#define ISQ_UI_SIZE_CACHE_STRIPES 16
+#else
+#define ISQ_UI_SIZE_CACHE_STRIPES 1
+#endif
+
+struct isq_ui_text_measure_entry {
+	isq_ui_key key;
+	struct isq_ui_text_metrics metrics;
+};
 
+// One line of word wrapped text, as byte offsets
+// into the text.
+struct isq_ui_wrap_line {
+	unsigned start;
+	unsigned end;
+	float width;
+};
+
+// Lines of a text or paragraph wrapped at a width
+// in [min_width, max_width).
+struct isq_ui_wrap {
+	isq_ui_key key;
+	float min_width;
+	float max_width;
+	float max_line_width;
+	unsigned line_count;
+	unsigned line_capacity;
+	struct isq_ui_wrap_line *lines;
+};
+
+struct isq_ui_size_cache_stripe {
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex mutex;
+#endif
+	unsigned hits;
+	unsigned misses;
+};
+
+// Glyph quads of one run of text, relative to
+// the run origin. vertices points just past the
+// run itself.
+struct isq_ui_glyph_run {
+	isq_ui_key key;
+	// Next run in the same bucket.
+	struct isq_ui_glyph_run *next;
+	// Neighbours in drawing order, most recent
+	// first.
+	struct isq_ui_glyph_run *newer;
+	struct isq_ui_glyph_run *older;
+	unsigned bytes;
+	unsigned vertex_count;
+	isq_ui_render_vertex *vertices;
+	// Atlas pages the run's glyphs are on, marked
+	// as used whenever the run is drawn.
+	struct isq_ui_atlas *atlas;
+	unsigned page_mask;
+	// A glyph didn't fit in the atlas, so the run
+	// is built again the next time it is drawn.
+	unsigned char incomplete;
+};
+
+// Layout of one descendant of a template box,
+// relative to the template box's position, or of
+// a keyed box in absolute coordinates.
+struct isq_ui_template_box {
+	isq_vec4 rect;
+	float scroll_offset_max;
+};
+
+struct isq_ui_template {
+	isq_ui_key key;
+	unsigned count;
+	unsigned capacity;
+	struct isq_ui_template_box *boxes;
+};
+
+// State of a keyed box that lives across frames.
+struct isq_ui_retained {
+	isq_ui_key key;
+	unsigned last_frame;
+	unsigned next_free;
+
+	isq_vec4 computed_rect;
 	float scroll_offset;
 	float scroll_offset_max;
+	// Id of the box last frame.
+	unsigned last_id;
+	// Resolved by isq_ui_end.
+	unsigned char hovered;
+	unsigned char clicked;
+
+	struct isq_ui_layout layout[ISQ_UI_LAYOUT_HISTORY];
+	unsigned layout_next;
+
+	// Last layout of the box's descendants. The
+	// buffer is kept when the slot is reused.
+	isq_ui_key subtree_key;
+	unsigned subtree_count;
+	unsigned subtree_capacity;
+	struct isq_ui_template_box *subtree;
+};
+
+enum isq_ui_layout_result {
+	ISQ_UI_LAYOUT_RESULT_SKIPPED,
+	ISQ_UI_LAYOUT_RESULT_COMPUTED,
+	ISQ_UI_LAYOUT_RESULT_REUSED,
+};
+
+// Hoverable and clickable boxes drawn last
+// frame, bucketed by the grid cells they cover.
+struct isq_ui_hit_cell {
+	unsigned *ids;
+	unsigned count;
+	unsigned capacity;
+};
+
+// A box as it is stored in the hit test grid.
+struct isq_ui_hit_entry {
+	isq_vec4 rect;
+	unsigned char indexed;
 };
 
 struct isq_ui_mouse {
@@ -279,16 +1108,107 @@ struct isq_ui_mouse {
 static isq_vec2 isq_ui_dimensions = {0};
 static struct isq_ui_mouse isq_ui_mouse = {0};
 
+static struct isq_ui_hit_cell *isq_ui_hit_cells = NULL;
+static unsigned isq_ui_hit_columns = 0;
+static unsigned isq_ui_hit_rows = 0;
+static struct isq_ui_hit_entry *isq_ui_hit_entries = NULL;
+static unsigned isq_ui_hit_entry_capacity = 0;
+static unsigned isq_ui_hit_entry_count = 0;
+// Topmost hoverable or clickable box under the
+// mouse, as an id from last frame.
+static unsigned isq_ui_hit_id = ISQ_UI_ID_NONE;
+static isq_vec2 isq_ui_hit_position = {0};
+static int isq_ui_hit_dirty = 1;
+
 static struct isq_ui_box *isq_ui_box_array = NULL;
 static unsigned isq_ui_box_array_capacity = 0;
 static unsigned isq_ui_box_array_count = 0;
 
-static struct isq_ui_box *isq_ui_current_parent = NULL;
-
-static struct isq_ui_vertex *isq_ui_vertex_buffer = NULL;
+// Hot box data, one array per field, indexed by
+// id like isq_ui_box_array. Hit testing, layout
+// and culling walk these and only touch the cold
+// struct for boxes they actually act on.
+static enum isq_ui_box_flags *isq_ui_box_flags_array = NULL;
+static unsigned *isq_ui_box_parent_array = NULL;
+static isq_vec4 *isq_ui_box_rect_array = NULL;
+static union isq_ui_sizes *isq_ui_box_size_array = NULL;
+// Filled in by isq_ui_render: the window bounds
+// intersected with every scrolling ancestor, and
+// whether the box overlaps that.
+static isq_vec4 *isq_ui_box_clip_array = NULL;
+static unsigned char *isq_ui_box_visible_array = NULL;
+
+static unsigned isq_ui_current_parent = ISQ_UI_ID_NONE;
+
+// Siblings list of the boxes without a parent.
+static unsigned isq_ui_root_first = ISQ_UI_ID_NONE;
+static unsigned isq_ui_root_last = ISQ_UI_ID_NONE;
+
+static unsigned isq_ui_frame = 0;
+
+static isq_ui_key isq_ui_key_stack[ISQ_UI_KEY_STACK_SIZE];
+static unsigned isq_ui_key_stack_count = 0;
+
+// Retained state lives in a dense array so that
+// boxes can hold on to an index that stays valid
+// while the lookup table grows. The table is open
+// addressed with linear probing and stores the
+// dense index + 1, so 0 marks an empty slot.
+static struct isq_ui_retained *isq_ui_retained_array = NULL;
+static unsigned isq_ui_retained_array_capacity = 0;
+static unsigned isq_ui_retained_array_count = 0;
+static unsigned isq_ui_retained_free = ISQ_UI_RETAINED_NONE;
+
+static unsigned *isq_ui_retained_table = NULL;
+static unsigned isq_ui_retained_table_capacity = 0;
+static unsigned isq_ui_retained_table_used = 0;
+
+#define ISQ_UI_RETAINED_TOMBSTONE ((unsigned)-1)
+
+static isq_ui_render_vertex *isq_ui_vertex_buffer = NULL;
 static unsigned isq_ui_vertex_buffer_capacity = 0;
 static unsigned isq_ui_vertex_buffer_count = 0;
 
+static struct isq_ui_command *isq_ui_command_buffer = NULL;
+static unsigned isq_ui_command_buffer_capacity = 0;
+static unsigned isq_ui_command_buffer_count = 0;
+
+// Runs of rects with the same clip and texture,
+// and the command each was merged into.
+struct isq_ui_batch_run {
+	isq_vec4 clip;
+	isq_vec4 bounds;
+	unsigned texture_index;
+	unsigned first;
+	unsigned count;
+	unsigned command;
+};
+
+#ifdef ISQ_UI_UNCHANGED_FRAMES
+static isq_ui_key isq_ui_render_hash = 0;
+static int isq_ui_render_unchanged = 0;
+#endif
+
+#ifdef ISQ_UI_DIRTY_RANGES
+// What the render macro was given last frame.
+static unsigned char *isq_ui_dirty_last = NULL;
+static unsigned isq_ui_dirty_last_size = 0;
+static unsigned isq_ui_dirty_last_capacity = 0;
+static struct isq_ui_dirty_range *isq_ui_dirty_range_buffer = NULL;
+static unsigned isq_ui_dirty_range_count = 0;
+static unsigned isq_ui_dirty_range_capacity = 0;
+#endif
+
+#ifdef ISQ_UI_RENDER_COMMANDS
+static struct isq_ui_batch_run *isq_ui_batch_runs = NULL;
+static unsigned isq_ui_batch_runs_capacity = 0;
+static isq_vec4 *isq_ui_batch_bounds = NULL;
+static unsigned *isq_ui_batch_cursors = NULL;
+static unsigned isq_ui_batch_commands_capacity = 0;
+static isq_ui_render_vertex *isq_ui_batch_vertex_buffer = NULL;
+static unsigned isq_ui_batch_vertex_buffer_capacity = 0;
+#endif
+
 static isq_vec4 isq_ui_default_uvs = {0, 0, 1, 1};
 
 static struct isq_ui_style isq_ui_style = {0};
@@ -297,6 +1217,42 @@ static unsigned isq_ui_used_bytes = 0;
 
 static float isq_ui_scroll_multiplier = 30;
 
+static enum isq_ui_layout_mode isq_ui_current_layout_mode = ISQ_UI_LAYOUT_IMMEDIATE;
+static enum isq_ui_interaction_mode isq_ui_current_interaction_mode = ISQ_UI_INTERACTION_IMMEDIATE;
+
+static struct isq_ui_stats isq_ui_stats = {0};
+
+static struct isq_ui_size_cache_entry isq_ui_size_cache[ISQ_UI_SIZE_CACHE_SIZE];
+static struct isq_ui_size_cache_stripe isq_ui_size_cache_stripes[ISQ_UI_SIZE_CACHE_STRIPES];
+
+static struct isq_ui_text_measure_entry isq_ui_text_measure_cache[ISQ_UI_TEXT_MEASURE_CACHE_SIZE];
+static struct isq_ui_size_cache_stripe isq_ui_text_measure_stripes[ISQ_UI_SIZE_CACHE_STRIPES];
+
+static struct isq_ui_wrap isq_ui_wrap_cache[ISQ_UI_WRAP_CACHE_SIZE];
+static struct isq_ui_wrap isq_ui_wrap_paragraph_cache[ISQ_UI_WRAP_CACHE_SIZE];
+static unsigned isq_ui_wrap_hits = 0;
+static unsigned isq_ui_wrap_misses = 0;
+static unsigned isq_ui_wrap_paragraphs = 0;
+#ifdef ISQ_UI_THREADS
+static isq_ui_mutex isq_ui_wrap_mutex;
+#endif
+
+static struct isq_ui_template isq_ui_template_cache[ISQ_UI_TEMPLATE_CACHE_SIZE];
+
+static struct isq_ui_glyph_run **isq_ui_glyph_run_table = NULL;
+static unsigned isq_ui_glyph_run_table_capacity = 0;
+static unsigned isq_ui_glyph_run_count = 0;
+static unsigned isq_ui_glyph_run_bytes = 0;
+static struct isq_ui_glyph_run *isq_ui_glyph_run_newest = NULL;
+static struct isq_ui_glyph_run *isq_ui_glyph_run_oldest = NULL;
+// Bumped whenever the pixels of any atlas page
+// change, which the vertices alone don't show.
+static unsigned isq_ui_atlas_generation = 0;
+#ifdef ISQ_UI_THREADS
+static isq_ui_mutex isq_ui_template_mutex;
+static isq_ui_mutex isq_ui_atlas_mutex;
+#endif
+
 static struct isq_ui_box *isq_ui_box_array_get(unsigned id) {
 	if (id >= isq_ui_box_array_count) {
 		return NULL;
@@ -305,471 +1261,3195 @@ static struct isq_ui_box *isq_ui_box_array_get(unsigned id) {
 	return &isq_ui_box_array[id];
 }
 
-static void isq_ui_enqueue_rect(isq_vec4 rect, isq_vec4 uvs, isq_vec4 color, float texture_index)
+static isq_ui_key isq_ui_hash_bytes(isq_ui_key seed, const void *data, unsigned long long size)
 {
-	if (isq_ui_vertex_buffer_count == isq_ui_vertex_buffer_capacity) {
-		isq_ui_vertex_buffer_capacity *= 2;
-		isq_ui_vertex_buffer = ISQ_REALLOC(isq_ui_vertex_buffer, sizeof(struct isq_ui_vertex) * isq_ui_vertex_buffer_capacity);
-	}
-
-	struct isq_ui_vertex *vertex = &isq_ui_vertex_buffer[isq_ui_vertex_buffer_count++];
-
-	vertex->position.x = rect.x;
-	vertex->position.y = rect.y;
-	vertex->position.z = 0;
-	vertex->color = color;
-	vertex->texture_index = texture_index;
-	vertex->uvs.u = uvs.x;
-	vertex->uvs.v = uvs.y;
-
-	vertex = &isq_ui_vertex_buffer[isq_ui_vertex_buffer_count++];
-
-	vertex->position.x = rect.z;
-	vertex->position.y = rect.y;
-	vertex->position.z = 0;
-	vertex->color = color;
-	vertex->texture_index = texture_index;
-	vertex->uvs.u = uvs.z;
-	vertex->uvs.v = uvs.y;
-
-	vertex = &isq_ui_vertex_buffer[isq_ui_vertex_buffer_count++];
-
-	vertex->position.x = rect.z;
-	vertex->position.y = rect.w;
-	vertex->position.z = 0;
-	vertex->color = color;
-	vertex->texture_index = texture_index;
-	vertex->uvs.u = uvs.z;
-	vertex->uvs.v = uvs.w;
-	
-	vertex = &isq_ui_vertex_buffer[isq_ui_vertex_buffer_count++];
-
-	vertex->position.x = rect.x;
-	vertex->position.y = rect.w;
-	vertex->position.z = 0;
-	vertex->color = color;
-	vertex->texture_index = texture_index;
-	vertex->uvs.u = uvs.x;
-	vertex->uvs.v = uvs.w;
+	// FNV-1a.
+	const unsigned char *bytes = data;
+	isq_ui_key hash = seed ? seed : 14695981039346656037ULL;
+
+	for (unsigned long long i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
 }
 
-isq_vec4 isq_vec4_add(isq_vec4 a, isq_vec4 b)
+static isq_ui_key isq_ui_key_combine(isq_ui_key seed, isq_ui_key key)
 {
-	isq_vec4 result = {0};
-	result.x = a.x + b.x;
-	result.y = a.y + b.y;
-	result.z = a.z + b.z;
-	result.w = a.w + b.w;
-	return result;
+	isq_ui_key hash = isq_ui_hash_bytes(seed, &key, sizeof(key));
+	return hash ? hash : 1;
 }
 
-isq_vec4 isq_vec4_scale(isq_vec4 a, float k)
+static unsigned isq_ui_retained_slot(isq_ui_key key)
 {
-	isq_vec4 result = {0};
-	result.x = a.x * k;
-	result.y = a.y * k;
-	result.z = a.z * k;
-	result.w = a.w * k;
-	return result;
+	// Keys are already hashed, fold the high bits
+	// in so small tables still see them.
+	return (unsigned)(key ^ (key >> 32)) & (isq_ui_retained_table_capacity - 1);
 }
 
-static void isq_ui_enqueue_border(isq_vec4 rect, isq_vec4 color, float width)
+static unsigned isq_ui_retained_find(isq_ui_key key)
 {
-	// Top
-	isq_vec4 border_rect = rect;
-	border_rect.y = rect.w - width;
-	isq_ui_enqueue_rect(border_rect, isq_ui_default_uvs, color, 0);
+	if (isq_ui_retained_table_capacity == 0)
+		return ISQ_UI_RETAINED_NONE;
 
-	// Bottom
-	border_rect.y = rect.y;
-	border_rect.w = rect.y + width;
-	isq_ui_enqueue_rect(border_rect, isq_ui_default_uvs, color, 0);
+	unsigned slot = isq_ui_retained_slot(key);
 
-	// Left
-	border_rect.y = rect.y + width;
-	border_rect.z = rect.x + width;
-	border_rect.w = rect.w - width;
-	isq_ui_enqueue_rect(border_rect, isq_ui_default_uvs, color, 0);
+	while (isq_ui_retained_table[slot]) {
+		unsigned entry = isq_ui_retained_table[slot];
+		if (entry != ISQ_UI_RETAINED_TOMBSTONE && isq_ui_retained_array[entry - 1].key == key)
+			return entry - 1;
 
-	// Right
-	border_rect.x = rect.z - width;
-	border_rect.z = rect.z;
-	isq_ui_enqueue_rect(border_rect, isq_ui_default_uvs, color, 0);
+		slot = (slot + 1) & (isq_ui_retained_table_capacity - 1);
+	}
+
+	return ISQ_UI_RETAINED_NONE;
 }
 
-static struct isq_ui_state isq_ui_interact(unsigned id)
+static void isq_ui_retained_table_place(unsigned index)
 {
-	struct isq_ui_state state = { .id = id };
-	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	unsigned slot = isq_ui_retained_slot(isq_ui_retained_array[index].key);
 
-	if (box->flags & ISQ_UI_BOX_FLAG_HOVERABLE) {
-		if (isq_ui_mouse.position.x >= box->computed_rect.x && isq_ui_mouse.position.y >= box->computed_rect.y &&
-			isq_ui_mouse.position.x < box->computed_rect.z && isq_ui_mouse.position.y < box->computed_rect.w) {
-			state.hovered = 1;
-		}
+	while (isq_ui_retained_table[slot] && isq_ui_retained_table[slot] != ISQ_UI_RETAINED_TOMBSTONE)
+		slot = (slot + 1) & (isq_ui_retained_table_capacity - 1);
+
+	if (isq_ui_retained_table[slot] == 0)
+		isq_ui_retained_table_used++;
+
+	isq_ui_retained_table[slot] = index + 1;
+}
+
+// Rebuild the table at the new capacity, which
+// also clears out the tombstones.
+static void isq_ui_retained_table_resize(unsigned capacity)
+{
+	ISQ_FREE(isq_ui_retained_table);
+	isq_ui_retained_table = ISQ_CALLOC(capacity, sizeof(unsigned));
+	isq_ui_retained_table_capacity = capacity;
+	isq_ui_retained_table_used = 0;
+
+	for (unsigned i = 0; i < isq_ui_retained_array_count; ++i) {
+		if (isq_ui_retained_array[i].key)
+			isq_ui_retained_table_place(i);
 	}
+}
 
-	if (box->flags & ISQ_UI_BOX_FLAG_CLICKABLE && isq_ui_mouse.left_down > 0) {
-		if (isq_ui_mouse.position.x >= box->computed_rect.x && isq_ui_mouse.position.y >= box->computed_rect.y &&
-			isq_ui_mouse.position.x < box->computed_rect.z && isq_ui_mouse.position.y < box->computed_rect.w) {
-			state.clicked = 1;
+static unsigned isq_ui_retained_insert(isq_ui_key key)
+{
+	unsigned index = isq_ui_retained_free;
+
+	if (index != ISQ_UI_RETAINED_NONE) {
+		isq_ui_retained_free = isq_ui_retained_array[index].next_free;
+	} else {
+		if (isq_ui_retained_array_count == isq_ui_retained_array_capacity) {
+			isq_ui_retained_array_capacity = isq_ui_retained_array_capacity ? isq_ui_retained_array_capacity * 2 : ISQ_UI_INITIAL_BUFFER_CAPACITY;
+			isq_ui_retained_array = ISQ_REALLOC(isq_ui_retained_array, sizeof(struct isq_ui_retained) * isq_ui_retained_array_capacity);
+			memset(&isq_ui_retained_array[isq_ui_retained_array_count], 0, sizeof(struct isq_ui_retained) * (isq_ui_retained_array_capacity - isq_ui_retained_array_count));
 		}
-	}
 
-	if (box->flags & ISQ_UI_BOX_FLAG_SCROLL_VERTICAL && isq_ui_mouse.scroll_delta != 0) {
-		box->scroll_offset -= isq_ui_mouse.scroll_delta * isq_ui_scroll_multiplier;
+		index = isq_ui_retained_array_count++;
+	}
 
-		if (box->scroll_offset < 0)
-			box->scroll_offset = 0;
-		if (box->scroll_offset > box->scroll_offset_max)
-			box->scroll_offset = box->scroll_offset_max;
+	struct isq_ui_template_box *subtree = isq_ui_retained_array[index].subtree;
+	unsigned subtree_capacity = isq_ui_retained_array[index].subtree_capacity;
+
+	memset(&isq_ui_retained_array[index], 0, sizeof(struct isq_ui_retained));
+	isq_ui_retained_array[index].subtree = subtree;
+	isq_ui_retained_array[index].subtree_capacity = subtree_capacity;
+	isq_ui_retained_array[index].key = key;
+	isq_ui_retained_array[index].last_id = ISQ_UI_ID_NONE;
+
+	// Keep the load factor, tombstones included,
+	// under 3/4.
+	if ((isq_ui_retained_table_used + 1) * 4 >= isq_ui_retained_table_capacity * 3) {
+		unsigned capacity = isq_ui_retained_table_capacity ? isq_ui_retained_table_capacity : ISQ_UI_INITIAL_BUFFER_CAPACITY;
+		while (isq_ui_retained_array_count * 2 >= capacity)
+			capacity *= 2;
+
+		isq_ui_retained_table_resize(capacity);
+	} else {
+		isq_ui_retained_table_place(index);
 	}
 
-	return state;
+	return index;
 }
 
-// TODO: 
-// - Word wrapping.
-// - Text alignment.
-// - Allow alphabets besides English.
-// - Rounded corners?
-static void isq_ui_render(void)
+static void isq_ui_retained_remove(unsigned index)
 {
-	for (unsigned i = 0; i < isq_ui_box_array_count; ++i) {
-		struct isq_ui_box *box = isq_ui_box_array_get(i);
+	struct isq_ui_retained *retained = &isq_ui_retained_array[index];
+	unsigned slot = isq_ui_retained_slot(retained->key);
 
-		bool cutoff_top = false;
-		float cutoff_size = 0;
+	while (isq_ui_retained_table[slot] != index + 1)
+		slot = (slot + 1) & (isq_ui_retained_table_capacity - 1);
 
-		// Don't show boxes past parent.
-		if (box->parent && box->parent->flags & ISQ_UI_BOX_FLAG_SCROLL_VERTICAL) {
-			// Scroll offset.
-			box->computed_rect.y -= box->parent->scroll_offset;
-			box->computed_rect.w -= box->parent->scroll_offset;
+	isq_ui_retained_table[slot] = ISQ_UI_RETAINED_TOMBSTONE;
 
-			// Don't display if scrolled off screen.
-			if (box->computed_rect.y > box->parent->computed_rect.w)
-				continue;
-			
-			if (box->computed_rect.w < box->parent->computed_rect.y)
-				continue;
+	retained->key = 0;
+	retained->next_free = isq_ui_retained_free;
+	isq_ui_retained_free = index;
+}
 
-			// Clamp to parent.
-			if (box->computed_rect.w > box->parent->computed_rect.w) {
-				box->computed_rect.w = box->parent->computed_rect.w;
-			}
+// Throw away state of keyed boxes that have not
+// been created recently.
+static void isq_ui_retained_collect(void)
+{
+	for (unsigned i = 0; i < isq_ui_retained_array_count; ++i) {
+		struct isq_ui_retained *retained = &isq_ui_retained_array[i];
+		if (retained->key && retained->last_frame + ISQ_UI_RETAINED_FRAMES < isq_ui_frame)
+			isq_ui_retained_remove(i);
+	}
+}
 
-			if (box->computed_rect.y < box->parent->computed_rect.y) {
-				cutoff_size = box->parent->computed_rect.y - box->computed_rect.y;
-				box->computed_rect.y = box->parent->computed_rect.y;
-				cutoff_top = true;
-			}
-		}
+// Copy this frame's state of keyed boxes back
+// into their retained entries.
+static void isq_ui_retained_store(void)
+{
+	for (unsigned i = 0; i < isq_ui_box_array_count; ++i) {
+		struct isq_ui_box *box = &isq_ui_box_array[i];
+		if (box->retained == ISQ_UI_RETAINED_NONE)
+			continue;
 
-		if (box->flags & ISQ_UI_BOX_FLAG_DRAW_BACKGROUND)
-			isq_ui_enqueue_rect(box->computed_rect, isq_ui_default_uvs, box->style.background_color, 0);
+		struct isq_ui_retained *retained = &isq_ui_retained_array[box->retained];
+		retained->computed_rect = isq_ui_box_rect_array[i];
+		retained->scroll_offset = box->scroll_offset;
+		retained->scroll_offset_max = box->scroll_offset_max;
+		retained->last_id = i;
+		retained->hovered = 0;
+		retained->clicked = 0;
+	}
+}
 
-		if (box->flags & ISQ_UI_BOX_FLAG_DRAW_BORDER)
-			isq_ui_enqueue_border(box->computed_rect, box->style.border_color, box->style.border_width);
+// Range of grid cells covered by rect. Returns 0
+// if it covers none.
+static int isq_ui_hit_cell_range(isq_vec4 rect, unsigned *x0, unsigned *y0, unsigned *x1, unsigned *y1)
+{
+	if (rect.z <= rect.x || rect.w <= rect.y || rect.z <= 0 || rect.w <= 0)
+		return 0;
 
-		// Only draw text if it exsits. 
-		if (box->text) {
-			const char *text = box->text;
+	float size = ISQ_UI_HIT_GRID_CELL_SIZE;
+	*x0 = rect.x > 0 ? (unsigned)(rect.x / size) : 0;
+	*y0 = rect.y > 0 ? (unsigned)(rect.y / size) : 0;
+	*x1 = (unsigned)(rect.z / size);
+	*y1 = (unsigned)(rect.w / size);
 
-			isq_vec2 pos = {box->computed_rect.x + box->style.padding.left, box->computed_rect.y + box->style.padding.top};
-			ISQ_UI_BAKED_QUAD_TYPE q;
+	if (*x0 >= isq_ui_hit_columns || *y0 >= isq_ui_hit_rows)
+		return 0;
+	if (*x1 >= isq_ui_hit_columns)
+		*x1 = isq_ui_hit_columns - 1;
+	if (*y1 >= isq_ui_hit_rows)
+		*y1 = isq_ui_hit_rows - 1;
+
+	return 1;
+}
+
+static void isq_ui_hit_insert(unsigned id, isq_vec4 rect)
+{
+	unsigned x0, y0, x1, y1;
+	if (!isq_ui_hit_cell_range(rect, &x0, &y0, &x1, &y1))
+		return;
+
+	for (unsigned y = y0; y <= y1; ++y) {
+		for (unsigned x = x0; x <= x1; ++x) {
+			struct isq_ui_hit_cell *cell = &isq_ui_hit_cells[y * isq_ui_hit_columns + x];
+
+			if (cell->count == cell->capacity) {
+				cell->capacity = cell->capacity ? cell->capacity * 2 : 8;
+				cell->ids = ISQ_REALLOC(cell->ids, sizeof(unsigned) * cell->capacity);
+			}
+
+			cell->ids[cell->count++] = id;
+		}
+	}
+}
+
+static void isq_ui_hit_remove(unsigned id, isq_vec4 rect)
+{
+	unsigned x0, y0, x1, y1;
+	if (!isq_ui_hit_cell_range(rect, &x0, &y0, &x1, &y1))
+		return;
+
+	for (unsigned y = y0; y <= y1; ++y) {
+		for (unsigned x = x0; x <= x1; ++x) {
+			struct isq_ui_hit_cell *cell = &isq_ui_hit_cells[y * isq_ui_hit_columns + x];
+
+			for (unsigned i = 0; i < cell->count; ++i) {
+				if (cell->ids[i] == id) {
+					cell->ids[i] = cell->ids[--cell->count];
+					break;
+				}
+			}
+		}
+	}
+}
+
+// Bring the grid up to date with the rects that
+// were just drawn. Only boxes whose rect or
+// flags changed since last frame are moved.
+static void isq_ui_hit_update(void)
+{
+	if (isq_ui_hit_entry_capacity < isq_ui_box_array_capacity) {
+		isq_ui_hit_entries = ISQ_REALLOC(isq_ui_hit_entries, sizeof(struct isq_ui_hit_entry) * isq_ui_box_array_capacity);
+		memset(isq_ui_hit_entries + isq_ui_hit_entry_capacity, 0, sizeof(struct isq_ui_hit_entry) * (isq_ui_box_array_capacity - isq_ui_hit_entry_capacity));
+		isq_ui_hit_entry_capacity = isq_ui_box_array_capacity;
+	}
+
+	for (unsigned i = 0; i < isq_ui_box_array_count; ++i) {
+		struct isq_ui_hit_entry *entry = &isq_ui_hit_entries[i];
+		isq_vec4 rect = isq_ui_box_rect_array[i];
+		isq_vec4 clip = isq_ui_box_clip_array[i];
+		int indexed = (isq_ui_box_flags_array[i] & (ISQ_UI_BOX_FLAG_HOVERABLE | ISQ_UI_BOX_FLAG_CLICKABLE)) && isq_ui_box_visible_array[i];
+
+		// Rects are no longer clamped to their scroll
+		// parent, so only the visible part is hit.
+		rect.x = rect.x > clip.x ? rect.x : clip.x;
+		rect.y = rect.y > clip.y ? rect.y : clip.y;
+		rect.z = rect.z < clip.z ? rect.z : clip.z;
+		rect.w = rect.w < clip.w ? rect.w : clip.w;
+
+		if (entry->indexed == indexed && (!indexed || !memcmp(&entry->rect, &rect, sizeof(rect))))
+			continue;
+
+		if (entry->indexed)
+			isq_ui_hit_remove(i, entry->rect);
+		if (indexed)
+			isq_ui_hit_insert(i, rect);
+
+		entry->rect = rect;
+		entry->indexed = indexed;
+		isq_ui_hit_dirty = 1;
+		isq_ui_stats.hit_grid_updates++;
+	}
+
+	for (unsigned i = isq_ui_box_array_count; i < isq_ui_hit_entry_count; ++i) {
+		struct isq_ui_hit_entry *entry = &isq_ui_hit_entries[i];
+		if (!entry->indexed)
+			continue;
+
+		isq_ui_hit_remove(i, entry->rect);
+		entry->indexed = 0;
+		isq_ui_hit_dirty = 1;
+		isq_ui_stats.hit_grid_updates++;
+	}
+
+	isq_ui_hit_entry_count = isq_ui_box_array_count;
+}
+
+// Find the topmost box under the mouse, which is
+// the one drawn last.
+static void isq_ui_hit_lookup(void)
+{
+	isq_vec2 position = isq_ui_mouse.position;
+
+	if (!isq_ui_hit_dirty && position.x == isq_ui_hit_position.x && position.y == isq_ui_hit_position.y)
+		return;
+
+	isq_ui_hit_dirty = 0;
+	isq_ui_hit_position = position;
+	isq_ui_hit_id = ISQ_UI_ID_NONE;
+	isq_ui_stats.hit_lookups++;
+
+	if (position.x < 0 || position.y < 0)
+		return;
+
+	unsigned x = (unsigned)(position.x / ISQ_UI_HIT_GRID_CELL_SIZE);
+	unsigned y = (unsigned)(position.y / ISQ_UI_HIT_GRID_CELL_SIZE);
+	if (x >= isq_ui_hit_columns || y >= isq_ui_hit_rows)
+		return;
+
+	struct isq_ui_hit_cell *cell = &isq_ui_hit_cells[y * isq_ui_hit_columns + x];
+
+	for (unsigned i = 0; i < cell->count; ++i) {
+		unsigned id = cell->ids[i];
+		isq_vec4 rect = isq_ui_hit_entries[id].rect;
+
+		if ((isq_ui_hit_id == ISQ_UI_ID_NONE || id > isq_ui_hit_id) &&
+			position.x >= rect.x && position.y >= rect.y && position.x < rect.z && position.y < rect.w)
+			isq_ui_hit_id = id;
+	}
+}
+
+#if defined(ISQ_UI_INSTANCES) || defined(ISQ_UI_COMPACT_VERTICES)
+// Round to nearest even, the same as the SIMD
+// conversions.
+static unsigned char isq_ui_unorm8(float value)
+{
+	return (unsigned char)(value <= 0 ? 0 : value >= 1 ? 255 : ISQ_LRINTF(value * 255));
+}
+#endif
+
+// Compact vertices only need these without SIMD.
+#if defined(ISQ_UI_INSTANCES) || (defined(ISQ_UI_COMPACT_VERTICES) && !defined(ISQ_UI_SIMD_AVX2) && !defined(ISQ_UI_SIMD_SSE2))
+static unsigned short isq_ui_unorm16(float value)
+{
+	return (unsigned short)(value <= 0 ? 0 : value >= 1 ? 65535 : ISQ_LRINTF(value * 65535));
+}
+#endif
+
+#if defined(ISQ_UI_INSTANCES)
+// Write the instance of rect to vertex.
+static void isq_ui_write_rect(isq_ui_render_vertex *vertex, isq_vec4 rect, isq_vec4 uvs, isq_vec4 color, float texture_index)
+{
+	vertex->rect = rect;
+	vertex->uvs[0] = isq_ui_unorm16(uvs.x);
+	vertex->uvs[1] = isq_ui_unorm16(uvs.y);
+	vertex->uvs[2] = isq_ui_unorm16(uvs.z);
+	vertex->uvs[3] = isq_ui_unorm16(uvs.w);
+	vertex->color[0] = isq_ui_unorm8(color.r);
+	vertex->color[1] = isq_ui_unorm8(color.g);
+	vertex->color[2] = isq_ui_unorm8(color.b);
+	vertex->color[3] = isq_ui_unorm8(color.a);
+	vertex->texture_index = (unsigned)texture_index;
+}
+
+// Move count vertices by offset and give them
+// color.
+static void isq_ui_move_rects(isq_ui_render_vertex *vertex, unsigned count, isq_vec2 offset, isq_vec4 color)
+{
+	unsigned char packed[4] = { isq_ui_unorm8(color.r), isq_ui_unorm8(color.g), isq_ui_unorm8(color.b), isq_ui_unorm8(color.a) };
+
+	for (unsigned i = 0; i < count; ++i) {
+		vertex[i].rect.x += offset.x;
+		vertex[i].rect.y += offset.y;
+		vertex[i].rect.z += offset.x;
+		vertex[i].rect.w += offset.y;
+		memcpy(vertex[i].color, packed, sizeof(packed));
+	}
+}
+#elif defined(ISQ_UI_COMPACT_VERTICES)
+#if !defined(ISQ_UI_SIMD_AVX2) && !defined(ISQ_UI_SIMD_SSE2)
+static short isq_ui_subpixels(float value)
+{
+	value *= ISQ_UI_COMPACT_SUBPIXELS;
+	return (short)(value <= -32768 ? -32768 : value >= 32767 ? 32767 : ISQ_LRINTF(value));
+}
+#endif
+
+// Write the 4 vertices of rect to vertex.
+static void isq_ui_write_rect(isq_ui_render_vertex *vertex, isq_vec4 rect, isq_vec4 uvs, isq_vec4 color, float texture_index)
+{
+#if defined(ISQ_UI_SIMD_AVX2) || defined(ISQ_UI_SIMD_SSE2)
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1);
+
+	// Rounded to nearest and saturated, like
+	// isq_ui_subpixels and isq_ui_unorm16.
+	__m128i position = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&rect.x), _mm_set1_ps(ISQ_UI_COMPACT_SUBPIXELS)));
+	position = _mm_packs_epi32(position, position);
+
+	// No unsigned 32 to 16 bit pack before SSE4.1,
+	// so go through signed and flip the top bit.
+	__m128i texcoord = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(&uvs.x), zero), one), _mm_set1_ps(65535)));
+	texcoord = _mm_sub_epi32(texcoord, _mm_set1_epi32(32768));
+	texcoord = _mm_xor_si128(_mm_packs_epi32(texcoord, texcoord), _mm_set1_epi16((short)0x8000));
+
+	__m128i rgba = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(&color.r), zero), one), _mm_set1_ps(255)));
+	rgba = _mm_packs_epi32(rgba, rgba);
+	rgba = _mm_packus_epi16(rgba, rgba);
+
+	// x0 y0 x1 y1 to the corners x0 y0, x1 y0, x1 y1,
+	// x0 y1, one per 32 bit lane.
+	position = _mm_unpacklo_epi64(position, position);
+	position = _mm_shufflehi_epi16(_mm_shufflelo_epi16(position, _MM_SHUFFLE(1, 2, 1, 0)), _MM_SHUFFLE(3, 0, 3, 2));
+	texcoord = _mm_unpacklo_epi64(texcoord, texcoord);
+	texcoord = _mm_shufflehi_epi16(_mm_shufflelo_epi16(texcoord, _MM_SHUFFLE(1, 2, 1, 0)), _MM_SHUFFLE(3, 0, 3, 2));
+
+	__m128i shared = _mm_unpacklo_epi32(rgba, _mm_set1_epi32((int)((unsigned)texture_index & 0xff)));
+	__m128i low = _mm_unpacklo_epi32(position, texcoord);
+	__m128i high = _mm_unpackhi_epi32(position, texcoord);
+
+	_mm_storeu_si128((__m128i *)&vertex[0], _mm_unpacklo_epi64(low, shared));
+	_mm_storeu_si128((__m128i *)&vertex[1], _mm_unpackhi_epi64(low, shared));
+	_mm_storeu_si128((__m128i *)&vertex[2], _mm_unpacklo_epi64(high, shared));
+	_mm_storeu_si128((__m128i *)&vertex[3], _mm_unpackhi_epi64(high, shared));
+#else
+	short x0 = isq_ui_subpixels(rect.x), y0 = isq_ui_subpixels(rect.y);
+	short x1 = isq_ui_subpixels(rect.z), y1 = isq_ui_subpixels(rect.w);
+	unsigned short u0 = isq_ui_unorm16(uvs.x), v0 = isq_ui_unorm16(uvs.y);
+	unsigned short u1 = isq_ui_unorm16(uvs.z), v1 = isq_ui_unorm16(uvs.w);
+	unsigned char texture = (unsigned char)((unsigned)texture_index & 0xff);
+
+	vertex[0] = (struct isq_ui_compact_vertex){ {x0, y0}, {u0, v0}, {0}, texture };
+	vertex[1] = (struct isq_ui_compact_vertex){ {x1, y0}, {u1, v0}, {0}, texture };
+	vertex[2] = (struct isq_ui_compact_vertex){ {x1, y1}, {u1, v1}, {0}, texture };
+	vertex[3] = (struct isq_ui_compact_vertex){ {x0, y1}, {u0, v1}, {0}, texture };
+
+	unsigned char packed[4] = { isq_ui_unorm8(color.r), isq_ui_unorm8(color.g), isq_ui_unorm8(color.b), isq_ui_unorm8(color.a) };
+	for (unsigned i = 0; i < 4; ++i)
+		memcpy(vertex[i].color, packed, sizeof(packed));
+#endif
+}
+
+// Move count vertices by offset and give them
+// color.
+static void isq_ui_move_rects(isq_ui_render_vertex *vertex, unsigned count, isq_vec2 offset, isq_vec4 color)
+{
+	long x = ISQ_LRINTF(offset.x * ISQ_UI_COMPACT_SUBPIXELS);
+	long y = ISQ_LRINTF(offset.y * ISQ_UI_COMPACT_SUBPIXELS);
+	unsigned char packed[4] = { isq_ui_unorm8(color.r), isq_ui_unorm8(color.g), isq_ui_unorm8(color.b), isq_ui_unorm8(color.a) };
+
+	for (unsigned i = 0; i < count; ++i) {
+		long px = vertex[i].position[0] + x;
+		long py = vertex[i].position[1] + y;
+		vertex[i].position[0] = (short)(px < -32768 ? -32768 : px > 32767 ? 32767 : px);
+		vertex[i].position[1] = (short)(py < -32768 ? -32768 : py > 32767 ? 32767 : py);
+		memcpy(vertex[i].color, packed, sizeof(packed));
+	}
+}
+#else
+// Write the 4 vertices of rect to vertex.
+static void isq_ui_write_rect(isq_ui_render_vertex *vertex, isq_vec4 rect, isq_vec4 uvs, isq_vec4 color, float texture_index)
+{
+	vertex[0] = (struct isq_ui_vertex){ {rect.x, rect.y, 0}, {uvs.x, uvs.y}, texture_index, color };
+	vertex[1] = (struct isq_ui_vertex){ {rect.z, rect.y, 0}, {uvs.z, uvs.y}, texture_index, color };
+	vertex[2] = (struct isq_ui_vertex){ {rect.z, rect.w, 0}, {uvs.z, uvs.w}, texture_index, color };
+	vertex[3] = (struct isq_ui_vertex){ {rect.x, rect.w, 0}, {uvs.x, uvs.w}, texture_index, color };
+}
+
+// Move count vertices by offset and give them
+// color.
+static void isq_ui_move_rects(isq_ui_render_vertex *vertex, unsigned count, isq_vec2 offset, isq_vec4 color)
+{
+	for (unsigned i = 0; i < count; ++i) {
+		vertex[i].position.x += offset.x;
+		vertex[i].position.y += offset.y;
+		vertex[i].color = color;
+	}
+}
+#endif
+
+// Make room for count more vertices.
+static void isq_ui_vertex_buffer_reserve(unsigned count)
+{
+	if (isq_ui_vertex_buffer_count + count <= isq_ui_vertex_buffer_capacity)
+		return;
+
+	while (isq_ui_vertex_buffer_count + count > isq_ui_vertex_buffer_capacity)
+		isq_ui_vertex_buffer_capacity *= 2;
+	isq_ui_vertex_buffer = ISQ_REALLOC(isq_ui_vertex_buffer, sizeof(isq_ui_render_vertex) * isq_ui_vertex_buffer_capacity);
+}
+
+static void isq_ui_enqueue_rect(isq_vec4 rect, isq_vec4 uvs, isq_vec4 color, float texture_index)
+{
+	isq_ui_vertex_buffer_reserve(ISQ_UI_RECT_VERTICES);
+	isq_ui_write_rect(&isq_ui_vertex_buffer[isq_ui_vertex_buffer_count], rect, uvs, color, texture_index);
+	isq_ui_vertex_buffer_count += ISQ_UI_RECT_VERTICES;
+}
+
+isq_vec4 isq_vec4_add(isq_vec4 a, isq_vec4 b)
+{
+	isq_vec4 result = {0};
+	result.x = a.x + b.x;
+	result.y = a.y + b.y;
+	result.z = a.z + b.z;
+	result.w = a.w + b.w;
+	return result;
+}
+
+isq_vec4 isq_vec4_scale(isq_vec4 a, float k)
+{
+	isq_vec4 result = {0};
+	result.x = a.x * k;
+	result.y = a.y * k;
+	result.z = a.z * k;
+	result.w = a.w * k;
+	return result;
+}
+
+static void isq_ui_enqueue_border(isq_vec4 rect, isq_vec4 color, float width)
+{
+	// Top
+	isq_vec4 border_rect = rect;
+	border_rect.y = rect.w - width;
+	isq_ui_enqueue_rect(border_rect, isq_ui_default_uvs, color, 0);
+
+	// Bottom
+	border_rect.y = rect.y;
+	border_rect.w = rect.y + width;
+	isq_ui_enqueue_rect(border_rect, isq_ui_default_uvs, color, 0);
+
+	// Left
+	border_rect.y = rect.y + width;
+	border_rect.z = rect.x + width;
+	border_rect.w = rect.w - width;
+	isq_ui_enqueue_rect(border_rect, isq_ui_default_uvs, color, 0);
+
+	// Right
+	border_rect.x = rect.z - width;
+	border_rect.z = rect.z;
+	isq_ui_enqueue_rect(border_rect, isq_ui_default_uvs, color, 0);
+}
+
+static void isq_ui_scroll(unsigned id)
+{
+	if (isq_ui_mouse.scroll_delta == 0)
+		return;
+
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	box->scroll_offset -= isq_ui_mouse.scroll_delta * isq_ui_scroll_multiplier;
+
+	if (box->scroll_offset < 0)
+		box->scroll_offset = 0;
+	if (box->scroll_offset > box->scroll_offset_max)
+		box->scroll_offset = box->scroll_offset_max;
+}
+
+// last_id is the id the box had last frame, which
+// is the same id unless the box is keyed.
+static struct isq_ui_state isq_ui_interact(unsigned id, unsigned last_id)
+{
+	struct isq_ui_state state = { .id = id };
+	enum isq_ui_box_flags flags = isq_ui_box_flags_array[id];
+
+	int inside = last_id != ISQ_UI_ID_NONE && last_id == isq_ui_hit_id;
+
+	if (flags & ISQ_UI_BOX_FLAG_HOVERABLE && inside)
+		state.hovered = 1;
+
+	if (flags & ISQ_UI_BOX_FLAG_CLICKABLE && isq_ui_mouse.left_down > 0 && inside)
+		state.clicked = 1;
+
+	if (flags & ISQ_UI_BOX_FLAG_SCROLL_VERTICAL)
+		isq_ui_scroll(id);
+
+	return state;
+}
+
+// Scrolling moves the whole subtree, and clips
+// it to every scrolling ancestor and the window.
+// Parents come first, so theirs are known.
+static void isq_ui_clip(void)
+{
+	isq_vec4 window = { 0, 0, isq_ui_dimensions.x, isq_ui_dimensions.y };
+
+	for (unsigned i = 0; i < isq_ui_box_array_count; ++i) {
+		unsigned parent_id = isq_ui_box_parent_array[i];
+		struct isq_ui_box *box = &isq_ui_box_array[i];
+		isq_vec4 clip = window;
+
+		box->scroll_shift = 0;
+		box->scroll_parent = ISQ_UI_ID_NONE;
+
+		if (parent_id != ISQ_UI_ID_NONE) {
+			struct isq_ui_box *parent = &isq_ui_box_array[parent_id];
+			box->scroll_shift = parent->scroll_shift;
+			box->scroll_parent = parent->scroll_parent;
+			clip = isq_ui_box_clip_array[parent_id];
+
+			if (isq_ui_box_flags_array[parent_id] & ISQ_UI_BOX_FLAG_SCROLL_VERTICAL) {
+				isq_vec4 parent_rect = isq_ui_box_rect_array[parent_id];
+
+				box->scroll_shift += parent->scroll_offset;
+				box->scroll_parent = parent_id;
+
+				clip.x = parent_rect.x > clip.x ? parent_rect.x : clip.x;
+				clip.y = parent_rect.y > clip.y ? parent_rect.y : clip.y;
+				clip.z = parent_rect.z < clip.z ? parent_rect.z : clip.z;
+				clip.w = parent_rect.w < clip.w ? parent_rect.w : clip.w;
+			}
+		}
+
+		isq_ui_box_rect_array[i].y -= box->scroll_shift;
+		isq_ui_box_rect_array[i].w -= box->scroll_shift;
+		isq_ui_box_clip_array[i] = clip;
+	}
+}
+
+// visible[i] = rects[i] overlaps clips[i].
+static void isq_ui_cull(const isq_vec4 *rects, const isq_vec4 *clips, unsigned char *visible, unsigned count)
+{
+	unsigned i = 0;
+
+#if defined(ISQ_UI_SIMD_AVX2)
+	// Transpose 8 rects into one register per
+	// field, boxes 0-3 in the low lane and 4-7 in
+	// the high one.
+#define ISQ_UI_LOAD_8(v, x, y, z, w) do { \
+		__m256 m0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps((v)[0].data)), _mm_loadu_ps((v)[4].data), 1); \
+		__m256 m1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps((v)[1].data)), _mm_loadu_ps((v)[5].data), 1); \
+		__m256 m2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps((v)[2].data)), _mm_loadu_ps((v)[6].data), 1); \
+		__m256 m3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps((v)[3].data)), _mm_loadu_ps((v)[7].data), 1); \
+		__m256 t0 = _mm256_unpacklo_ps(m0, m1); \
+		__m256 t1 = _mm256_unpackhi_ps(m0, m1); \
+		__m256 t2 = _mm256_unpacklo_ps(m2, m3); \
+		__m256 t3 = _mm256_unpackhi_ps(m2, m3); \
+		x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)); \
+		y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)); \
+		z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)); \
+		w = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2)); \
+	} while (0)
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 rx, ry, rz, rw, cx, cy, cz, cw;
+		ISQ_UI_LOAD_8(rects + i, rx, ry, rz, rw);
+		ISQ_UI_LOAD_8(clips + i, cx, cy, cz, cw);
+
+		__m256 inside = _mm256_and_ps(
+			_mm256_and_ps(_mm256_cmp_ps(rx, cz, _CMP_LT_OQ), _mm256_cmp_ps(ry, cw, _CMP_LT_OQ)),
+			_mm256_and_ps(_mm256_cmp_ps(rz, cx, _CMP_GT_OQ), _mm256_cmp_ps(rw, cy, _CMP_GT_OQ)));
+		int mask = _mm256_movemask_ps(inside);
+
+		for (unsigned j = 0; j < 8; ++j)
+			visible[i + j] = (mask >> j) & 1;
+	}
+#undef ISQ_UI_LOAD_8
+#elif defined(ISQ_UI_SIMD_SSE2)
+	for (; i + 4 <= count; i += 4) {
+		__m128 rx = _mm_loadu_ps(rects[i].data);
+		__m128 ry = _mm_loadu_ps(rects[i + 1].data);
+		__m128 rz = _mm_loadu_ps(rects[i + 2].data);
+		__m128 rw = _mm_loadu_ps(rects[i + 3].data);
+		_MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+
+		__m128 cx = _mm_loadu_ps(clips[i].data);
+		__m128 cy = _mm_loadu_ps(clips[i + 1].data);
+		__m128 cz = _mm_loadu_ps(clips[i + 2].data);
+		__m128 cw = _mm_loadu_ps(clips[i + 3].data);
+		_MM_TRANSPOSE4_PS(cx, cy, cz, cw);
+
+		__m128 inside = _mm_and_ps(
+			_mm_and_ps(_mm_cmplt_ps(rx, cz), _mm_cmplt_ps(ry, cw)),
+			_mm_and_ps(_mm_cmpgt_ps(rz, cx), _mm_cmpgt_ps(rw, cy)));
+		int mask = _mm_movemask_ps(inside);
+
+		for (unsigned j = 0; j < 4; ++j)
+			visible[i + j] = (mask >> j) & 1;
+	}
+#endif
+
+	for (; i < count; ++i) {
+		isq_vec4 rect = rects[i];
+		isq_vec4 clip = clips[i];
+		visible[i] = rect.x < clip.z && rect.y < clip.w && rect.z > clip.x && rect.w > clip.y;
+	}
+}
+
+// Close the current command, dropping it if no
+// vertices were added under its clip.
+static void isq_ui_end_command(void)
+{
+	if (isq_ui_command_buffer_count == 0)
+		return;
+
+	struct isq_ui_command *command = &isq_ui_command_buffer[isq_ui_command_buffer_count - 1];
+	command->count = isq_ui_vertex_buffer_count - command->first;
+	if (command->count == 0)
+		isq_ui_command_buffer_count--;
+}
+
+// Start a new command if clip differs from the
+// current one. Boxes are drawn parents first, so
+// the clip only changes when entering or leaving
+// a scrolling box.
+static void isq_ui_set_clip(isq_vec4 clip)
+{
+	isq_ui_end_command();
+
+	if (isq_ui_command_buffer_count > 0) {
+		struct isq_ui_command *command = &isq_ui_command_buffer[isq_ui_command_buffer_count - 1];
+		if (!memcmp(&command->clip, &clip, sizeof(clip)))
+			return;
+	}
+
+	if (isq_ui_command_buffer_count == isq_ui_command_buffer_capacity) {
+		isq_ui_command_buffer_capacity = isq_ui_command_buffer_capacity ? isq_ui_command_buffer_capacity * 2 : ISQ_UI_INITIAL_BUFFER_CAPACITY;
+		isq_ui_command_buffer = ISQ_REALLOC(isq_ui_command_buffer, sizeof(struct isq_ui_command) * isq_ui_command_buffer_capacity);
+	}
+
+	isq_ui_command_buffer[isq_ui_command_buffer_count++] = (struct isq_ui_command){
+		.clip = clip,
+		.first = isq_ui_vertex_buffer_count,
+	};
+}
+
+#ifdef ISQ_UI_RENDER_COMMANDS
+// Texture and bounds of the rect at vertex.
+#if defined(ISQ_UI_INSTANCES)
+static unsigned isq_ui_rect_texture(const isq_ui_render_vertex *vertex)
+{
+	return vertex->texture_index;
+}
+
+static isq_vec4 isq_ui_rect_bounds(const isq_ui_render_vertex *vertex)
+{
+	return vertex->rect;
+}
+#elif defined(ISQ_UI_COMPACT_VERTICES)
+static unsigned isq_ui_rect_texture(const isq_ui_render_vertex *vertex)
+{
+	return vertex->texture_index;
+}
+
+static isq_vec4 isq_ui_rect_bounds(const isq_ui_render_vertex *vertex)
+{
+	float scale = 1.0f / ISQ_UI_COMPACT_SUBPIXELS;
+	return (isq_vec4){ vertex[0].position[0] * scale, vertex[0].position[1] * scale, vertex[2].position[0] * scale, vertex[2].position[1] * scale };
+}
+#else
+static unsigned isq_ui_rect_texture(const isq_ui_render_vertex *vertex)
+{
+	return (unsigned)vertex->texture_index;
+}
+
+static isq_vec4 isq_ui_rect_bounds(const isq_ui_render_vertex *vertex)
+{
+	return (isq_vec4){ vertex[0].position.x, vertex[0].position.y, vertex[2].position.x, vertex[2].position.y };
+}
+#endif
+
+static int isq_ui_rects_overlap(isq_vec4 a, isq_vec4 b)
+{
+	return a.x < b.z && b.x < a.z && a.y < b.w && b.y < a.w;
+}
+
+// Split the clip commands where the texture
+// changes, then move each run of rects back to the
+// latest command with the same clip and texture,
+// as long as it overlaps nothing drawn in between.
+// Rects within a command keep their order.
+static isq_ui_render_vertex *isq_ui_batch(isq_ui_render_vertex *mapped)
+{
+	// Runs of one texture within each command.
+	unsigned run_count = 0;
+	for (unsigned i = 0; i < isq_ui_command_buffer_count; ++i) {
+		struct isq_ui_command command = isq_ui_command_buffer[i];
+		unsigned end = command.first + command.count;
+
+		for (unsigned first = command.first; first < end; first += ISQ_UI_RECT_VERTICES) {
+			const isq_ui_render_vertex *vertex = &isq_ui_vertex_buffer[first];
+			unsigned texture_index = isq_ui_rect_texture(vertex);
+			isq_vec4 bounds = isq_ui_rect_bounds(vertex);
+
+			struct isq_ui_batch_run *run = run_count ? &isq_ui_batch_runs[run_count - 1] : NULL;
+			if (run && run->first + run->count == first && run->texture_index == texture_index && first != command.first) {
+				run->count += ISQ_UI_RECT_VERTICES;
+				run->bounds = (isq_vec4){
+					bounds.x < run->bounds.x ? bounds.x : run->bounds.x,
+					bounds.y < run->bounds.y ? bounds.y : run->bounds.y,
+					bounds.z > run->bounds.z ? bounds.z : run->bounds.z,
+					bounds.w > run->bounds.w ? bounds.w : run->bounds.w,
+				};
+				continue;
+			}
+
+			if (run_count == isq_ui_batch_runs_capacity) {
+				isq_ui_batch_runs_capacity = isq_ui_batch_runs_capacity ? isq_ui_batch_runs_capacity * 2 : ISQ_UI_INITIAL_BUFFER_CAPACITY;
+				isq_ui_batch_runs = ISQ_REALLOC(isq_ui_batch_runs, sizeof(struct isq_ui_batch_run) * isq_ui_batch_runs_capacity);
+			}
+
+			isq_ui_batch_runs[run_count++] = (struct isq_ui_batch_run){
+				.clip = command.clip,
+				.bounds = bounds,
+				.texture_index = texture_index,
+				.first = first,
+				.count = ISQ_UI_RECT_VERTICES,
+			};
+		}
+	}
+
+	if (run_count > isq_ui_command_buffer_capacity) {
+		while (run_count > isq_ui_command_buffer_capacity)
+			isq_ui_command_buffer_capacity = isq_ui_command_buffer_capacity ? isq_ui_command_buffer_capacity * 2 : ISQ_UI_INITIAL_BUFFER_CAPACITY;
+		isq_ui_command_buffer = ISQ_REALLOC(isq_ui_command_buffer, sizeof(struct isq_ui_command) * isq_ui_command_buffer_capacity);
+	}
+
+	if (run_count > isq_ui_batch_commands_capacity) {
+		isq_ui_batch_commands_capacity = isq_ui_command_buffer_capacity;
+		isq_ui_batch_bounds = ISQ_REALLOC(isq_ui_batch_bounds, sizeof(isq_vec4) * isq_ui_batch_commands_capacity);
+		isq_ui_batch_cursors = ISQ_REALLOC(isq_ui_batch_cursors, sizeof(unsigned) * isq_ui_batch_commands_capacity);
+	}
+
+	// Build the commands again from the runs.
+	unsigned command_count = 0;
+	for (unsigned i = 0; i < run_count; ++i) {
+		struct isq_ui_batch_run *run = &isq_ui_batch_runs[i];
+		unsigned target = ISQ_UI_ID_NONE;
+
+		// Only what survives the clip can overlap.
+		run->bounds = (isq_vec4){
+			run->bounds.x > run->clip.x ? run->bounds.x : run->clip.x,
+			run->bounds.y > run->clip.y ? run->bounds.y : run->clip.y,
+			run->bounds.z < run->clip.z ? run->bounds.z : run->clip.z,
+			run->bounds.w < run->clip.w ? run->bounds.w : run->clip.w,
+		};
+
+		for (unsigned j = command_count, n = 0; j > 0 && n < ISQ_UI_BATCH_LOOKBACK; --j, ++n) {
+			struct isq_ui_command *command = &isq_ui_command_buffer[j - 1];
+			if (command->texture_index == run->texture_index && !memcmp(&command->clip, &run->clip, sizeof(run->clip))) {
+				target = j - 1;
+				break;
+			}
+
+			if (isq_ui_rects_overlap(isq_ui_batch_bounds[j - 1], run->bounds))
+				break;
+		}
+
+		if (target == ISQ_UI_ID_NONE) {
+			target = command_count++;
+			isq_ui_command_buffer[target] = (struct isq_ui_command){
+				.clip = run->clip,
+				.texture_index = run->texture_index,
+			};
+			isq_ui_batch_bounds[target] = run->bounds;
+		} else {
+			isq_vec4 *bounds = &isq_ui_batch_bounds[target];
+			*bounds = (isq_vec4){
+				run->bounds.x < bounds->x ? run->bounds.x : bounds->x,
+				run->bounds.y < bounds->y ? run->bounds.y : bounds->y,
+				run->bounds.z > bounds->z ? run->bounds.z : bounds->z,
+				run->bounds.w > bounds->w ? run->bounds.w : bounds->w,
+			};
+		}
+
+		run->command = target;
+		isq_ui_command_buffer[target].count += run->count;
+	}
+
+	isq_ui_command_buffer_count = command_count;
+	isq_ui_stats.draw_batches = command_count;
+	isq_ui_stats.draw_batches_merged = run_count - command_count;
+
+	unsigned first = 0;
+	for (unsigned i = 0; i < command_count; ++i) {
+		isq_ui_command_buffer[i].first = first;
+		isq_ui_batch_cursors[i] = first;
+		first += isq_ui_command_buffer[i].count;
+	}
+
+	if (command_count == run_count) {
+		if (!mapped)
+			return isq_ui_vertex_buffer;
+
+		memcpy(mapped, isq_ui_vertex_buffer, sizeof(isq_ui_render_vertex) * isq_ui_vertex_buffer_count);
+		return mapped;
+	}
+
+	// Copy the runs into command order.
+	isq_ui_render_vertex *destination = mapped;
+	if (!destination) {
+		if (isq_ui_batch_vertex_buffer_capacity < isq_ui_vertex_buffer_capacity) {
+			isq_ui_batch_vertex_buffer_capacity = isq_ui_vertex_buffer_capacity;
+			isq_ui_batch_vertex_buffer = ISQ_REALLOC(isq_ui_batch_vertex_buffer, sizeof(isq_ui_render_vertex) * isq_ui_batch_vertex_buffer_capacity);
+		}
+		destination = isq_ui_batch_vertex_buffer;
+	}
+
+	for (unsigned i = 0; i < run_count; ++i) {
+		struct isq_ui_batch_run *run = &isq_ui_batch_runs[i];
+		unsigned *cursor = &isq_ui_batch_cursors[run->command];
+		memcpy(&destination[*cursor], &isq_ui_vertex_buffer[run->first], sizeof(isq_ui_render_vertex) * run->count);
+		*cursor += run->count;
+	}
+
+	if (mapped)
+		return mapped;
+
+	isq_ui_render_vertex *vertices = isq_ui_vertex_buffer;
+	unsigned capacity = isq_ui_vertex_buffer_capacity;
+	isq_ui_vertex_buffer = isq_ui_batch_vertex_buffer;
+	isq_ui_vertex_buffer_capacity = isq_ui_batch_vertex_buffer_capacity;
+	isq_ui_batch_vertex_buffer = vertices;
+	isq_ui_batch_vertex_buffer_capacity = capacity;
+
+	return isq_ui_vertex_buffer;
+}
+#endif
+
+#ifdef ISQ_UI_UNCHANGED_FRAMES
+// FNV-1a a word at a time, for buffers that are
+// hashed whole every frame.
+static isq_ui_key isq_ui_hash_words(isq_ui_key seed, const void *data, unsigned long long size)
+{
+	const unsigned char *bytes = data;
+	isq_ui_key hash = seed ? seed : 14695981039346656037ULL;
+
+	unsigned long long i = 0;
+	for (; i + sizeof(hash) <= size; i += sizeof(hash)) {
+		isq_ui_key word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash ^= word;
+		hash *= 1099511628211ULL;
+	}
+
+	return isq_ui_hash_bytes(hash, bytes + i, size - i);
+}
+#endif
+
+#ifdef ISQ_UI_DIRTY_RANGES
+// Find the chunks of the render buffer that
+// changed since last frame and keep a copy of
+// them for the next.
+static void isq_ui_dirty_update(const isq_ui_render_vertex *vertices)
+{
+	const unsigned char *bytes = (const unsigned char *)vertices;
+	unsigned size = isq_ui_vertex_buffer_count * (unsigned)sizeof(isq_ui_render_vertex);
+
+	if (size > isq_ui_dirty_last_capacity) {
+		while (size > isq_ui_dirty_last_capacity)
+			isq_ui_dirty_last_capacity = isq_ui_dirty_last_capacity ? isq_ui_dirty_last_capacity * 2 : ISQ_UI_DIRTY_CHUNK_SIZE;
+		isq_ui_dirty_last = ISQ_REALLOC(isq_ui_dirty_last, isq_ui_dirty_last_capacity);
+	}
+
+	isq_ui_dirty_range_count = 0;
+	isq_ui_stats.dirty_bytes = 0;
+
+	for (unsigned offset = 0; offset < size; offset += ISQ_UI_DIRTY_CHUNK_SIZE) {
+		unsigned chunk = size - offset < ISQ_UI_DIRTY_CHUNK_SIZE ? size - offset : ISQ_UI_DIRTY_CHUNK_SIZE;
+		if (offset + chunk <= isq_ui_dirty_last_size && !memcmp(bytes + offset, isq_ui_dirty_last + offset, chunk))
+			continue;
+
+		memcpy(isq_ui_dirty_last + offset, bytes + offset, chunk);
+		isq_ui_stats.dirty_bytes += chunk;
+
+		struct isq_ui_dirty_range *range = isq_ui_dirty_range_count ? &isq_ui_dirty_range_buffer[isq_ui_dirty_range_count - 1] : NULL;
+		if (range && range->offset + range->size == offset) {
+			range->size += chunk;
+			continue;
+		}
+
+		if (isq_ui_dirty_range_count == isq_ui_dirty_range_capacity) {
+			isq_ui_dirty_range_capacity = isq_ui_dirty_range_capacity ? isq_ui_dirty_range_capacity * 2 : ISQ_UI_INITIAL_BUFFER_CAPACITY;
+			isq_ui_dirty_range_buffer = ISQ_REALLOC(isq_ui_dirty_range_buffer, sizeof(struct isq_ui_dirty_range) * isq_ui_dirty_range_capacity);
+		}
+
+		isq_ui_dirty_range_buffer[isq_ui_dirty_range_count++] = (struct isq_ui_dirty_range){ offset, chunk };
+	}
+
+	isq_ui_dirty_last_size = size;
+}
+#endif
+
+// Walks the codepoints of UTF-8 text. Runs of
+// ASCII are found a block at a time and returned
+// without decoding. Malformed sequences decode to
+// U+FFFD one byte at a time.
+struct isq_ui_text_iter {
+	const unsigned char *at;
+	const unsigned char *end;
+	// Bytes before ascii_end are known to be ASCII.
+	const unsigned char *ascii_end;
+};
+
+static struct isq_ui_text_iter isq_ui_text_iter(const char *text, unsigned length)
+{
+	const unsigned char *at = (const unsigned char *)text;
+	return (struct isq_ui_text_iter){ at, at + length, at };
+}
+
+// End of the run of ASCII bytes starting at at.
+static const unsigned char *isq_ui_ascii_end(const unsigned char *at, const unsigned char *end)
+{
+#if defined(ISQ_UI_SIMD_AVX2)
+	while (end - at >= 32 && !_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)at)))
+		at += 32;
+#endif
+#if defined(ISQ_UI_SIMD_AVX2) || defined(ISQ_UI_SIMD_SSE2)
+	while (end - at >= 16 && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)at)))
+		at += 16;
+#else
+	while (end - at >= 8) {
+		unsigned long long block;
+		memcpy(&block, at, sizeof(block));
+		if (block & 0x8080808080808080ULL)
+			break;
+		at += 8;
+	}
+#endif
+	while (at < end && *at < 0x80)
+		++at;
+
+	return at;
+}
+
+static int isq_ui_text_next(struct isq_ui_text_iter *iter, unsigned *codepoint)
+{
+	const unsigned char *at = iter->at;
+
+	if (at < iter->ascii_end) {
+		*codepoint = *at;
+		iter->at = at + 1;
+		return 1;
+	}
+
+	if (at >= iter->end)
+		return 0;
+
+	if (*at < 0x80) {
+		iter->ascii_end = isq_ui_ascii_end(at, iter->end);
+		*codepoint = *at;
+		iter->at = at + 1;
+		return 1;
+	}
+
+	unsigned length = *at >= 0xf0 ? 4 : *at >= 0xe0 ? 3 : *at >= 0xc0 ? 2 : 0;
+	unsigned value = *at & (0x7f >> length);
+	int valid = length && *at < 0xf5 && (unsigned)(iter->end - at) >= length;
+
+	for (unsigned i = 1; valid && i < length; ++i) {
+		valid = (at[i] & 0xc0) == 0x80;
+		value = (value << 6) | (at[i] & 0x3f);
+	}
+
+	// No overlong encodings or surrogates.
+	static const unsigned smallest[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+	if (!valid || value < smallest[length] || value > 0x10ffff || (value >= 0xd800 && value <= 0xdfff)) {
+		*codepoint = 0xfffd;
+		iter->at = at + 1;
+		return 1;
+	}
+
+	*codepoint = value;
+	iter->at = at + length;
+	return 1;
+}
+
+// Index of codepoint's glyph in the font's
+// character data, or ISQ_UI_GLYPH_NONE.
+static unsigned isq_ui_glyph_index(const struct isq_ui_font *font, unsigned codepoint)
+{
+	if (!font->glyphs)
+		return codepoint >= 32 && codepoint < 128 ? codepoint - 32 : ISQ_UI_GLYPH_NONE;
+
+	if (codepoint > 0x10ffff)
+		return ISQ_UI_GLYPH_NONE;
+
+	const unsigned *page = font->glyphs->pages[codepoint >> 8];
+	return page ? page[codepoint & 0xff] : ISQ_UI_GLYPH_NONE;
+}
+
+static isq_ui_key isq_ui_atlas_key(void *font, unsigned codepoint, float size)
+{
+	isq_ui_key key = isq_ui_hash_bytes(0, &font, sizeof(font));
+	key = isq_ui_hash_bytes(key, &codepoint, sizeof(codepoint));
+	key = isq_ui_hash_bytes(key, &size, sizeof(size));
+	return key ? key : 1;
+}
+
+static void isq_ui_atlas_slots_insert(struct isq_ui_atlas *atlas, unsigned index)
+{
+	isq_ui_key key = atlas->glyphs[index].key;
+	unsigned slot = (unsigned)(key ^ (key >> 32)) & (atlas->slot_capacity - 1);
+
+	while (atlas->slots[slot])
+		slot = (slot + 1) & (atlas->slot_capacity - 1);
+	atlas->slots[slot] = index + 1;
+}
+
+static void isq_ui_atlas_slots_rebuild(struct isq_ui_atlas *atlas)
+{
+	while (atlas->slot_capacity < atlas->glyph_capacity * 2)
+		atlas->slot_capacity = atlas->slot_capacity ? atlas->slot_capacity * 2 : 256;
+
+	ISQ_FREE(atlas->slots);
+	atlas->slots = ISQ_CALLOC(atlas->slot_capacity, sizeof(unsigned));
+
+	for (unsigned i = 0; i < atlas->glyph_count; ++i)
+		isq_ui_atlas_slots_insert(atlas, i);
+}
+
+static void isq_ui_atlas_page_reset(struct isq_ui_atlas *atlas, struct isq_ui_atlas_page *page)
+{
+	memset(page->pixels, 0, atlas->page_size * atlas->page_size);
+	page->nodes[0] = (struct isq_ui_atlas_node){ 0, 0, atlas->page_size };
+	page->node_count = 1;
+	page->dirty[0] = 0;
+	page->dirty[1] = 0;
+	page->dirty[2] = atlas->page_size;
+	page->dirty[3] = atlas->page_size;
+	isq_ui_atlas_generation++;
+}
+
+// y at which a width x height rect fits on the
+// skyline starting at node index, or -1.
+static int isq_ui_skyline_fit(const struct isq_ui_atlas *atlas, const struct isq_ui_atlas_page *page, unsigned index, unsigned width, unsigned height)
+{
+	unsigned x = page->nodes[index].x;
+	if (x + width > atlas->page_size)
+		return -1;
+
+	unsigned y = 0;
+	int left = (int)width;
+	for (unsigned i = index; left > 0; ++i) {
+		if (page->nodes[i].y > y)
+			y = page->nodes[i].y;
+		if (y + height > atlas->page_size)
+			return -1;
+		left -= (int)page->nodes[i].width;
+	}
+
+	return (int)y;
+}
+
+// Place a rect on the page's skyline, lowest top
+// edge first, then the tightest node.
+static int isq_ui_skyline_pack(const struct isq_ui_atlas *atlas, struct isq_ui_atlas_page *page, unsigned width, unsigned height, unsigned *out_x, unsigned *out_y)
+{
+	unsigned best = ISQ_UI_ID_NONE;
+	unsigned best_bottom = ~0u;
+	unsigned best_width = ~0u;
+
+	for (unsigned i = 0; i < page->node_count; ++i) {
+		int y = isq_ui_skyline_fit(atlas, page, i, width, height);
+		if (y < 0)
+			continue;
+
+		unsigned bottom = (unsigned)y + height;
+		if (bottom < best_bottom || (bottom == best_bottom && page->nodes[i].width < best_width)) {
+			best = i;
+			best_bottom = bottom;
+			best_width = page->nodes[i].width;
+		}
+	}
+
+	if (best == ISQ_UI_ID_NONE)
+		return 0;
+
+	struct isq_ui_atlas_node node = { page->nodes[best].x, best_bottom, width };
+	*out_x = node.x;
+	*out_y = best_bottom - height;
+
+	memmove(&page->nodes[best + 1], &page->nodes[best], sizeof(struct isq_ui_atlas_node) * (page->node_count - best));
+	page->nodes[best] = node;
+	page->node_count++;
+
+	// Trim the nodes the new one covers.
+	unsigned i = best + 1;
+	while (i < page->node_count) {
+		struct isq_ui_atlas_node *next = &page->nodes[i];
+		unsigned end = node.x + node.width;
+		if (next->x >= end)
+			break;
+
+		unsigned shrink = end - next->x;
+		if (shrink < next->width) {
+			next->x += shrink;
+			next->width -= shrink;
+			break;
+		}
+
+		memmove(next, next + 1, sizeof(struct isq_ui_atlas_node) * (page->node_count - i - 1));
+		page->node_count--;
+	}
+
+	// Merge neighbours at the same height.
+	for (i = 0; i + 1 < page->node_count; ) {
+		if (page->nodes[i].y == page->nodes[i + 1].y) {
+			page->nodes[i].width += page->nodes[i + 1].width;
+			memmove(&page->nodes[i + 1], &page->nodes[i + 2], sizeof(struct isq_ui_atlas_node) * (page->node_count - i - 2));
+			page->node_count--;
+		} else {
+			++i;
+		}
+	}
+
+	return 1;
+}
+
+static void isq_ui_glyph_run_drop(struct isq_ui_atlas *atlas, unsigned page_mask);
+
+// Drop every glyph on the least recently used page
+// that wasn't used this frame, and reset it.
+static struct isq_ui_atlas_page *isq_ui_atlas_evict(struct isq_ui_atlas *atlas)
+{
+	struct isq_ui_atlas_page *oldest = NULL;
+	for (unsigned i = 0; i < atlas->page_count; ++i) {
+		struct isq_ui_atlas_page *page = &atlas->pages[i];
+		if (page->last_used != isq_ui_frame && (!oldest || page->last_used < oldest->last_used))
+			oldest = page;
+	}
+
+	if (!oldest)
+		return NULL;
+
+	unsigned page_index = (unsigned)(oldest - atlas->pages);
+	unsigned count = 0;
+	for (unsigned i = 0; i < atlas->glyph_count; ++i) {
+		if (atlas->glyphs[i].page != page_index)
+			atlas->glyphs[count++] = atlas->glyphs[i];
+	}
+	atlas->glyph_count = count;
+	isq_ui_atlas_slots_rebuild(atlas);
+	isq_ui_atlas_page_reset(atlas, oldest);
+	atlas->evictions++;
+
+	// Cached glyph runs may point into the page.
+	isq_ui_glyph_run_drop(atlas, 1u << page_index);
+
+	return oldest;
+}
+
+// Find room for a glyph, adding a page or evicting
+// one if needed.
+static unsigned isq_ui_atlas_place(struct isq_ui_atlas *atlas, unsigned width, unsigned height, unsigned *x, unsigned *y)
+{
+	for (unsigned i = 0; i < atlas->page_count; ++i) {
+		if (isq_ui_skyline_pack(atlas, &atlas->pages[i], width, height, x, y))
+			return i;
+	}
+
+	struct isq_ui_atlas_page *page = NULL;
+	if (atlas->page_count < atlas->max_pages) {
+		page = &atlas->pages[atlas->page_count++];
+		page->pixels = ISQ_MALLOC(atlas->page_size * atlas->page_size);
+		page->nodes = ISQ_MALLOC(sizeof(struct isq_ui_atlas_node) * (atlas->page_size + 1));
+		page->last_used = isq_ui_frame;
+		isq_ui_atlas_page_reset(atlas, page);
+	} else {
+		page = isq_ui_atlas_evict(atlas);
+	}
+
+	if (page && isq_ui_skyline_pack(atlas, page, width, height, x, y))
+		return (unsigned)(page - atlas->pages);
+
+	return ISQ_UI_GLYPH_NONE;
+}
+
+// Squared distance transform of one row or column
+// of n samples f, stride apart, into d. See
+// Felzenszwalb and Huttenlocher, "Distance
+// Transforms of Sampled Functions".
+static void isq_ui_edt_1d(float *f, int n, int stride, float *d, int *v, float *z)
+{
+	int k = 0;
+	v[0] = 0;
+	z[0] = -FLT_MAX;
+	z[1] = FLT_MAX;
+
+	for (int q = 1; q < n; ++q) {
+		float s;
+		for (;; --k) {
+			int p = v[k];
+			s = ((f[q * stride] + q * q) - (f[p * stride] + p * p)) / (2.0f * (q - p));
+			if (s > z[k])
+				break;
+		}
+
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = FLT_MAX;
+	}
+
+	k = 0;
+	for (int q = 0; q < n; ++q) {
+		while (z[k + 1] < q)
+			k++;
+		float dq = (float)(q - v[k]);
+		d[q] = dq * dq + f[v[k] * stride];
+	}
+
+	for (int q = 0; q < n; ++q)
+		f[q * stride] = d[q];
+}
+
+// Squared distance from every texel of grid to the
+// nearest texel that was 0, in place.
+static void isq_ui_edt(float *grid, int width, int height, float *d, int *v, float *z)
+{
+	for (int x = 0; x < width; ++x)
+		isq_ui_edt_1d(grid + x, height, width, d, v, z);
+	for (int y = 0; y < height; ++y)
+		isq_ui_edt_1d(grid + y * width, width, 1, d, v, z);
+}
+
+// Turn width x height coverage into a signed
+// distance field spread texels wider on each side.
+// 128 is the outline, and every spread / 127
+// texels further in or out is one step up or down.
+static void isq_ui_sdf_build(const unsigned char *coverage, int width, int height, int spread, unsigned char *out, int stride)
+{
+	int w = width + 2 * spread;
+	int h = height + 2 * spread;
+	int n = w > h ? w : h;
+	float big = (float)(w * w + h * h);
+
+	float *inside = ISQ_MALLOC(sizeof(float) * w * h);
+	float *outside = ISQ_MALLOC(sizeof(float) * w * h);
+	float *d = ISQ_MALLOC(sizeof(float) * n);
+	float *z = ISQ_MALLOC(sizeof(float) * (n + 1));
+	int *v = ISQ_MALLOC(sizeof(int) * n);
+
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			int cx = x - spread;
+			int cy = y - spread;
+			int in = cx >= 0 && cy >= 0 && cx < width && cy < height && coverage[cy * width + cx] >= 128;
+			inside[y * w + x] = in ? 0 : big;
+			outside[y * w + x] = in ? big : 0;
+		}
+	}
+
+	isq_ui_edt(inside, w, h, d, v, z);
+	isq_ui_edt(outside, w, h, d, v, z);
+
+	float scale = 127.0f / spread;
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			// The outline runs half a texel from the
+			// centres on either side of it.
+			float distance = outside[y * w + x] > 0 ? ISQ_SQRTF(outside[y * w + x]) - 0.5f : 0.5f - ISQ_SQRTF(inside[y * w + x]);
+			float value = 128.0f + distance * scale;
+			out[y * stride + x] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+		}
+	}
+
+	ISQ_FREE(inside);
+	ISQ_FREE(outside);
+	ISQ_FREE(d);
+	ISQ_FREE(z);
+	ISQ_FREE(v);
+}
+
+// Glyph for codepoint of font at size, rasterized
+// into the atlas the first time it is asked for.
+static struct isq_ui_atlas_glyph isq_ui_atlas_glyph(struct isq_ui_atlas *atlas, void *font, unsigned codepoint, float size)
+{
+	// Distance field glyphs are made once, at the
+	// reference size, and scaled to every other.
+	if (atlas->sdf_spread)
+		size = atlas->sdf_size;
+
+	isq_ui_key key = isq_ui_atlas_key(font, codepoint, size);
+	struct isq_ui_atlas_glyph glyph;
+
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_lock(&isq_ui_atlas_mutex);
+#endif
+	if (atlas->slot_capacity) {
+		unsigned slot = (unsigned)(key ^ (key >> 32)) & (atlas->slot_capacity - 1);
+		while (atlas->slots[slot] && atlas->glyphs[atlas->slots[slot] - 1].key != key)
+			slot = (slot + 1) & (atlas->slot_capacity - 1);
+
+		if (atlas->slots[slot]) {
+			glyph = atlas->glyphs[atlas->slots[slot] - 1];
+			if (glyph.page != ISQ_UI_GLYPH_NONE)
+				atlas->pages[glyph.page].last_used = isq_ui_frame;
+			goto done;
+		}
+	}
+
+	struct isq_ui_glyph_metrics metrics = {0};
+	atlas->rasterize(font, codepoint, size, &metrics, NULL, 0, atlas->user);
+
+	glyph = (struct isq_ui_atlas_glyph){
+		.key = key,
+		.page = ISQ_UI_GLYPH_NONE,
+		.x_offset = metrics.x_offset,
+		.y_offset = metrics.y_offset,
+		.advance = metrics.advance,
+	};
+
+	if (metrics.width > 0 && metrics.height > 0) {
+		// Distance fields reach spread texels past
+		// the outline.
+		int spread = (int)atlas->sdf_spread;
+		glyph.width = metrics.width + 2 * spread;
+		glyph.height = metrics.height + 2 * spread;
+		glyph.x_offset -= spread;
+		glyph.y_offset -= spread;
+
+		// One texel of padding so neighbours don't
+		// bleed into each other when filtered.
+		unsigned x, y;
+		glyph.page = isq_ui_atlas_place(atlas, glyph.width + 1, glyph.height + 1, &x, &y);
+
+		// Out of room for now, try again next time.
+		if (glyph.page == ISQ_UI_GLYPH_NONE) {
+			atlas->place_failures++;
+			goto done;
+		}
+
+		struct isq_ui_atlas_page *page = &atlas->pages[glyph.page];
+		glyph.x = x;
+		glyph.y = y;
+		page->last_used = isq_ui_frame;
+
+		unsigned char *pixels = page->pixels + y * atlas->page_size + x;
+		if (spread) {
+			unsigned char *coverage = ISQ_CALLOC((size_t)metrics.width * metrics.height, 1);
+			atlas->rasterize(font, codepoint, size, &metrics, coverage, metrics.width, atlas->user);
+			isq_ui_sdf_build(coverage, metrics.width, metrics.height, spread, pixels, (int)atlas->page_size);
+			ISQ_FREE(coverage);
+		} else {
+			atlas->rasterize(font, codepoint, size, &metrics, pixels, (int)atlas->page_size, atlas->user);
+		}
+
+		unsigned x1 = x + glyph.width;
+		unsigned y1 = y + glyph.height;
+		if (page->dirty[2] == page->dirty[0]) {
+			page->dirty[0] = x;
+			page->dirty[1] = y;
+			page->dirty[2] = x1;
+			page->dirty[3] = y1;
+		} else {
+			page->dirty[0] = x < page->dirty[0] ? x : page->dirty[0];
+			page->dirty[1] = y < page->dirty[1] ? y : page->dirty[1];
+			page->dirty[2] = x1 > page->dirty[2] ? x1 : page->dirty[2];
+			page->dirty[3] = y1 > page->dirty[3] ? y1 : page->dirty[3];
+		}
+		isq_ui_atlas_generation++;
+	}
+
+	if (atlas->glyph_count == atlas->glyph_capacity) {
+		atlas->glyph_capacity = atlas->glyph_capacity ? atlas->glyph_capacity * 2 : 256;
+		atlas->glyphs = ISQ_REALLOC(atlas->glyphs, sizeof(struct isq_ui_atlas_glyph) * atlas->glyph_capacity);
+		isq_ui_atlas_slots_rebuild(atlas);
+	}
+
+	atlas->glyphs[atlas->glyph_count] = glyph;
+	isq_ui_atlas_slots_insert(atlas, atlas->glyph_count++);
+
+done:
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_unlock(&isq_ui_atlas_mutex);
+#endif
+	return glyph;
+}
+
+// Bake the quad of codepoint at pos and advance
+// pos. Returns 0 if the font has no glyph for it,
+// or it has no pixels. texture_index may be NULL.
+static int isq_ui_glyph_quad(const struct isq_ui_font *font, unsigned codepoint, isq_vec2 *pos, ISQ_UI_BAKED_QUAD_TYPE *q, unsigned *texture_index)
+{
+	if (font->atlas) {
+		struct isq_ui_atlas *atlas = font->atlas;
+		if (codepoint < 32)
+			return 0;
+
+		struct isq_ui_atlas_glyph glyph = isq_ui_atlas_glyph(atlas, font->character_data, codepoint, (float)font->size);
+
+		float x, y, scale = 1;
+		if (atlas->sdf_spread) {
+			// Fields scale smoothly, no need to snap
+			// to pixels.
+			scale = font->size / atlas->sdf_size;
+			x = pos->x + glyph.x_offset * scale;
+			y = pos->y + glyph.y_offset * scale;
+		} else {
+			// Same rounding as stbtt_GetBakedQuad.
+			x = ISQ_FLOORF(pos->x + glyph.x_offset + 0.5f);
+			y = ISQ_FLOORF(pos->y + glyph.y_offset + 0.5f);
+		}
+		pos->x += glyph.advance * scale;
+
+		if (glyph.page == ISQ_UI_GLYPH_NONE)
+			return 0;
+
+		float texel = 1.0f / atlas->page_size;
+		q->x0 = x;
+		q->y0 = y;
+		q->x1 = x + glyph.width * scale;
+		q->y1 = y + glyph.height * scale;
+		q->s0 = glyph.x * texel;
+		q->t0 = glyph.y * texel;
+		q->s1 = (glyph.x + glyph.width) * texel;
+		q->t1 = (glyph.y + glyph.height) * texel;
+
+		if (texture_index)
+			*texture_index = atlas->first_texture_index + glyph.page;
+		return 1;
+	}
+
+	unsigned glyph = isq_ui_glyph_index(font, codepoint);
+	if (glyph == ISQ_UI_GLYPH_NONE)
+		return 0;
+
+	ISQ_UI_BAKED_QUAD(font->character_data, ISQ_UI_BAKED_WIDTH, ISQ_UI_BAKED_HEIGHT, glyph, &pos->x, &pos->y, q, 1);
+	if (texture_index)
+		*texture_index = font->texture_index;
+	return 1;
+}
+
+static void isq_ui_glyph_run_unlink(struct isq_ui_glyph_run *run)
+{
+	if (run->newer)
+		run->newer->older = run->older;
+	else
+		isq_ui_glyph_run_newest = run->older;
+
+	if (run->older)
+		run->older->newer = run->newer;
+	else
+		isq_ui_glyph_run_oldest = run->newer;
+}
+
+static void isq_ui_glyph_run_link(struct isq_ui_glyph_run *run)
+{
+	run->newer = NULL;
+	run->older = isq_ui_glyph_run_newest;
+	if (isq_ui_glyph_run_newest)
+		isq_ui_glyph_run_newest->newer = run;
+	else
+		isq_ui_glyph_run_oldest = run;
+	isq_ui_glyph_run_newest = run;
+}
+
+static struct isq_ui_glyph_run **isq_ui_glyph_run_bucket(isq_ui_key key)
+{
+	return &isq_ui_glyph_run_table[(unsigned)(key ^ (key >> 32)) & (isq_ui_glyph_run_table_capacity - 1)];
+}
+
+static void isq_ui_glyph_run_remove(struct isq_ui_glyph_run *run)
+{
+	struct isq_ui_glyph_run **link = isq_ui_glyph_run_bucket(run->key);
+
+	while (*link != run)
+		link = &(*link)->next;
+	*link = run->next;
+
+	isq_ui_glyph_run_unlink(run);
+	isq_ui_glyph_run_count--;
+	isq_ui_glyph_run_bytes -= run->bytes;
+	ISQ_FREE(run);
+}
+
+// Drop the least recently drawn run.
+static void isq_ui_glyph_run_evict(void)
+{
+	isq_ui_glyph_run_remove(isq_ui_glyph_run_oldest);
+}
+
+// Drop the runs drawn from any of the pages of
+// atlas in page_mask, or with ~0u every run drawn
+// from atlas.
+static void isq_ui_glyph_run_drop(struct isq_ui_atlas *atlas, unsigned page_mask)
+{
+	struct isq_ui_glyph_run *run = isq_ui_glyph_run_oldest;
+	while (run) {
+		struct isq_ui_glyph_run *newer = run->newer;
+		if (run->atlas == atlas && (page_mask == ~0u || (run->page_mask & page_mask)))
+			isq_ui_glyph_run_remove(run);
+		run = newer;
+	}
+}
+
+static void isq_ui_glyph_run_table_grow(void)
+{
+	struct isq_ui_glyph_run **old_table = isq_ui_glyph_run_table;
+	unsigned old_capacity = isq_ui_glyph_run_table_capacity;
+
+	isq_ui_glyph_run_table_capacity = old_capacity ? old_capacity * 2 : 256;
+	isq_ui_glyph_run_table = ISQ_CALLOC(isq_ui_glyph_run_table_capacity, sizeof(struct isq_ui_glyph_run *));
+
+	for (unsigned i = 0; i < old_capacity; ++i) {
+		struct isq_ui_glyph_run *run = old_table[i];
+		while (run) {
+			struct isq_ui_glyph_run *next = run->next;
+			struct isq_ui_glyph_run **bucket = isq_ui_glyph_run_bucket(run->key);
+			run->next = *bucket;
+			*bucket = run;
+			run = next;
+		}
+	}
+
+	ISQ_FREE(old_table);
+}
+
+// Glyph quads for length bytes of text in font,
+// baked at the origin. Returns NULL if the run
+// alone is larger than ISQ_UI_GLYPH_CACHE_BYTES.
+static struct isq_ui_glyph_run *isq_ui_glyph_run_get(struct isq_ui_font font, const char *text, unsigned length)
+{
+	isq_ui_key key = isq_ui_hash_bytes(0, &font, sizeof(font));
+	key = isq_ui_hash_bytes(key, text, length);
+
+	if (isq_ui_glyph_run_table_capacity) {
+		struct isq_ui_glyph_run *run = *isq_ui_glyph_run_bucket(key);
+		while (run && run->key != key)
+			run = run->next;
+
+		// Its vertices were already copied out, so it
+		// can go.
+		if (run && run->incomplete) {
+			isq_ui_glyph_run_remove(run);
+			run = NULL;
+		}
+
+		if (run) {
+			isq_ui_glyph_run_unlink(run);
+			isq_ui_glyph_run_link(run);
+			isq_ui_stats.glyph_cache_hits++;
+
+			// Keep the run's pages from being evicted
+			// while its vertices are in use.
+			for (unsigned mask = run->page_mask; mask; mask &= mask - 1) {
+				unsigned page = 0;
+				while (!(mask & (1u << page)))
+					page++;
+				run->atlas->pages[page].last_used = isq_ui_frame;
+			}
+			return run;
+		}
+	}
+
+	isq_ui_stats.glyph_cache_misses++;
+
+	struct isq_ui_text_iter iter = isq_ui_text_iter(text, length);
+	unsigned codepoint;
+	unsigned glyph_count = 0;
+
+	// An upper bound when the font has an atlas,
+	// since glyphs without pixels get no quad.
+	while (isq_ui_text_next(&iter, &codepoint))
+		glyph_count += font.atlas ? codepoint >= 32 : isq_ui_glyph_index(&font, codepoint) != ISQ_UI_GLYPH_NONE;
+
+	unsigned bytes = sizeof(struct isq_ui_glyph_run) + sizeof(isq_ui_render_vertex) * ISQ_UI_RECT_VERTICES * glyph_count;
+	if (bytes > ISQ_UI_GLYPH_CACHE_BYTES)
+		return NULL;
+
+	while (isq_ui_glyph_run_bytes + bytes > ISQ_UI_GLYPH_CACHE_BYTES)
+		isq_ui_glyph_run_evict();
+
+	if (isq_ui_glyph_run_count >= isq_ui_glyph_run_table_capacity)
+		isq_ui_glyph_run_table_grow();
+
+	struct isq_ui_glyph_run *run = ISQ_MALLOC(bytes);
+	run->key = key;
+	run->bytes = bytes;
+	run->vertices = (isq_ui_render_vertex *)(run + 1);
+	run->atlas = font.atlas;
+	run->page_mask = 0;
+
+	unsigned place_failures = font.atlas ? font.atlas->place_failures : 0;
+
+	isq_vec2 pos = {0};
+	ISQ_UI_BAKED_QUAD_TYPE q;
+	unsigned texture_index;
+	isq_ui_render_vertex *vertex = run->vertices;
+
+	iter = isq_ui_text_iter(text, length);
+	while (isq_ui_text_next(&iter, &codepoint)) {
+		if (!isq_ui_glyph_quad(&font, codepoint, &pos, &q, &texture_index))
+			continue;
+
+		isq_vec4 text_rect = (isq_vec4){q.x0, q.y0 + font.size * 0.75, q.x1, q.y1 + font.size * 0.75};
+		isq_vec4 text_uvs = (isq_vec4){q.s0, q.t0, q.s1, q.t1};
+
+		isq_ui_write_rect(vertex, text_rect, text_uvs, (isq_vec4){0}, texture_index);
+		vertex += ISQ_UI_RECT_VERTICES;
+
+		if (font.atlas)
+			run->page_mask |= 1u << (texture_index - font.atlas->first_texture_index);
+	}
+	run->vertex_count = (unsigned)(vertex - run->vertices);
+	run->incomplete = font.atlas && font.atlas->place_failures != place_failures;
+
+	struct isq_ui_glyph_run **bucket = isq_ui_glyph_run_bucket(key);
+	run->next = *bucket;
+	*bucket = run;
+	isq_ui_glyph_run_link(run);
+	isq_ui_glyph_run_count++;
+	isq_ui_glyph_run_bytes += bytes;
+
+	return run;
+}
+
+// Draw length bytes of text of a box as one line
+// starting at pos. Text that was drawn recently is
+// copied from the glyph run cache and moved into
+// place.
+static void isq_ui_enqueue_run(struct isq_ui_box *box, const char *text, unsigned length, isq_vec2 pos)
+{
+	struct isq_ui_glyph_run *run = isq_ui_glyph_run_get(box->style.font, text, length);
+
+	if (!run) {
+		struct isq_ui_text_iter iter = isq_ui_text_iter(text, length);
+		unsigned codepoint;
+		ISQ_UI_BAKED_QUAD_TYPE q;
+		unsigned texture_index;
+
+		while (isq_ui_text_next(&iter, &codepoint)) {
+			if (!isq_ui_glyph_quad(&box->style.font, codepoint, &pos, &q, &texture_index))
+				continue;
+
+			isq_vec4 text_rect = (isq_vec4){q.x0, q.y0 + box->style.font.size * 0.75, q.x1, q.y1 + box->style.font.size * 0.75};
+			isq_vec4 text_uvs = (isq_vec4){q.s0, q.t0, q.s1, q.t1};
+
+			isq_ui_enqueue_rect(text_rect, text_uvs, box->style.text_color, texture_index);
+		}
+
+		return;
+	}
+
+	isq_ui_vertex_buffer_reserve(run->vertex_count);
+
+	isq_ui_render_vertex *vertex = &isq_ui_vertex_buffer[isq_ui_vertex_buffer_count];
+	memcpy(vertex, run->vertices, sizeof(isq_ui_render_vertex) * run->vertex_count);
+	isq_ui_vertex_buffer_count += run->vertex_count;
+
+	isq_ui_move_rects(vertex, run->vertex_count, pos, box->style.text_color);
+}
+
+static const struct isq_ui_wrap *isq_ui_wrap_text(struct isq_ui_font font, const char *text, float width);
+
+// TODO: 
+// - Text alignment.
+// - Rounded corners?
+
+// Draw the text of a box inside rect, one line per
+// '\n', or word wrapped to the width of rect.
+static void isq_ui_enqueue_text(struct isq_ui_box *box, enum isq_ui_box_flags flags, isq_vec4 rect)
+{
+	isq_vec2 pos = {rect.x + box->style.padding.left, rect.y + box->style.padding.top};
+	const char *text = box->text;
+
+	if (flags & ISQ_UI_BOX_FLAG_TEXT_WRAP_WORD) {
+		float width = rect.z - rect.x - box->style.padding.left - box->style.padding.right;
+		const struct isq_ui_wrap *wrap = isq_ui_wrap_text(box->style.font, text, width);
+
+		for (unsigned i = 0; i < wrap->line_count; ++i) {
+			struct isq_ui_wrap_line line = wrap->lines[i];
+			isq_ui_enqueue_run(box, text + line.start, line.end - line.start, (isq_vec2){pos.x, pos.y + box->style.font.size * i});
+		}
+
+		return;
+	}
+
+	for (;;) {
+		const char *end = text;
+		while (*end && *end != '\n')
+			++end;
+
+		isq_ui_enqueue_run(box, text, (unsigned)(end - text), pos);
+
+		if (!*end)
+			break;
+
+		text = end + 1;
+		pos.y += box->style.font.size;
+	}
+}
+
+static void isq_ui_render(void)
+{
+	isq_ui_clip();
+	isq_ui_cull(isq_ui_box_rect_array, isq_ui_box_clip_array, isq_ui_box_visible_array, isq_ui_box_array_count);
+
+	for (unsigned i = 0; i < isq_ui_box_array_count; ++i) {
+		if (!isq_ui_box_visible_array[i])
+			continue;
+
+		enum isq_ui_box_flags flags = isq_ui_box_flags_array[i];
+		isq_vec4 *rect = &isq_ui_box_rect_array[i];
+		struct isq_ui_box *box = &isq_ui_box_array[i];
+
+		isq_ui_set_clip(isq_ui_box_clip_array[i]);
+
+		if (flags & ISQ_UI_BOX_FLAG_DRAW_BACKGROUND)
+			isq_ui_enqueue_rect(*rect, isq_ui_default_uvs, box->style.background_color, 0);
+
+		if (flags & ISQ_UI_BOX_FLAG_DRAW_BORDER)
+			isq_ui_enqueue_border(*rect, box->style.border_color, box->style.border_width);
+
+		// Only draw text if it exsits. 
+		if (box->text)
+			isq_ui_enqueue_text(box, flags, *rect);
+	}
+
+	isq_ui_end_command();
+
+#ifdef ISQ_UI_UNCHANGED_FRAMES
+	// Batching only depends on the commands and
+	// vertices, so hash them as they are. An atlas
+	// page can be drawn over with other glyphs
+	// without any vertex changing.
+	isq_ui_key hash = isq_ui_hash_bytes(0, &isq_ui_dimensions, sizeof(isq_ui_dimensions));
+	hash = isq_ui_hash_bytes(hash, &isq_ui_atlas_generation, sizeof(isq_ui_atlas_generation));
+	hash = isq_ui_hash_words(hash, isq_ui_command_buffer, sizeof(struct isq_ui_command) * isq_ui_command_buffer_count);
+	hash = isq_ui_hash_words(hash, isq_ui_vertex_buffer, sizeof(isq_ui_render_vertex) * isq_ui_vertex_buffer_count);
+
+	isq_ui_render_unchanged = hash == isq_ui_render_hash;
+	isq_ui_render_hash = hash;
+	if (isq_ui_render_unchanged)
+		return;
+#endif
+
+	isq_ui_render_vertex *mapped = NULL;
+#ifdef ISQ_UI_MAP_VERTICES
+	if (isq_ui_vertex_buffer_count > 0)
+		mapped = (isq_ui_render_vertex *)(ISQ_UI_MAP_VERTICES(isq_ui_vertex_buffer_count));
+#endif
+
+#ifdef ISQ_UI_RENDER_COMMANDS
+	isq_ui_render_vertex *vertices = isq_ui_batch(mapped);
+#else
+	isq_ui_render_vertex *vertices = isq_ui_vertex_buffer;
+	if (mapped) {
+		memcpy(mapped, vertices, sizeof(isq_ui_render_vertex) * isq_ui_vertex_buffer_count);
+		vertices = mapped;
+	}
+#endif
+
+#ifdef ISQ_UI_DIRTY_RANGES
+	isq_ui_dirty_update(vertices);
+#endif
+
+#ifdef ISQ_UI_RENDER_COMMANDS
+	ISQ_UI_RENDER_COMMANDS(isq_ui_command_buffer, isq_ui_command_buffer_count, vertices, isq_ui_vertex_buffer_count);
+#else
+	ISQ_UI_RENDER_RECT(vertices, isq_ui_vertex_buffer_count);
+#endif
+}
+
+static struct isq_ui_text_metrics isq_ui_text_metrics_compute(struct isq_ui_font font, const char *text)
+{
+	struct isq_ui_text_metrics metrics = {0};
+	float width_start = ISQ_UI_MAGIC_NUMBERF;
+	float line_start = ISQ_UI_MAGIC_NUMBERF;
+	isq_vec2 pos = {0};
+	ISQ_UI_BAKED_QUAD_TYPE q;
+
+	if (!text)
+		return metrics;
+
+	metrics.line_count = 1;
+
+	struct isq_ui_text_iter iter = isq_ui_text_iter(text, (unsigned)ISQ_STRLEN(text));
+	unsigned codepoint;
+
+	while (isq_ui_text_next(&iter, &codepoint)) {
+		if (codepoint == '\n') {
+			metrics.line_count++;
+			line_start = ISQ_UI_MAGIC_NUMBERF;
+			continue;
+		}
+
+		if (!isq_ui_glyph_quad(&font, codepoint, &pos, &q, NULL))
+			continue;
+
+		if (width_start == ISQ_UI_MAGIC_NUMBERF)
+			width_start = q.x0;
+		if (line_start == ISQ_UI_MAGIC_NUMBERF)
+			line_start = q.x0;
+
+		metrics.width = q.x1 - width_start;
+		if (q.x1 - line_start > metrics.max_line_width)
+			metrics.max_line_width = q.x1 - line_start;
+	}
+
+	return metrics;
+}
+
+struct isq_ui_text_metrics isq_ui_measure_text(struct isq_ui_font font, const char *text)
+{
+	if (!text)
+		return (struct isq_ui_text_metrics){0};
+
+	isq_ui_key key = isq_ui_hash_bytes(0, &font, sizeof(font));
+	key = isq_ui_hash_bytes(key, text, ISQ_STRLEN(text));
+	key = key ? key : 1;
+
+	unsigned index = (unsigned)key & (ISQ_UI_TEXT_MEASURE_CACHE_SIZE - 1);
+	struct isq_ui_text_measure_entry *entry = &isq_ui_text_measure_cache[index];
+	struct isq_ui_size_cache_stripe *stripe = &isq_ui_text_measure_stripes[index % ISQ_UI_SIZE_CACHE_STRIPES];
+	struct isq_ui_text_metrics metrics;
+
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_lock(&stripe->mutex);
+#endif
+	int hit = entry->key == key;
+	if (hit) {
+		metrics = entry->metrics;
+		stripe->hits++;
+	} else {
+		stripe->misses++;
+	}
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_unlock(&stripe->mutex);
+#endif
+
+	if (hit)
+		return metrics;
+
+	metrics = isq_ui_text_metrics_compute(font, text);
+
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_lock(&stripe->mutex);
+#endif
+	entry->key = key;
+	entry->metrics = metrics;
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_unlock(&stripe->mutex);
+#endif
+
+	return metrics;
+}
+
+static void isq_ui_wrap_push(struct isq_ui_wrap *wrap, unsigned start, unsigned end, float width, unsigned words)
+{
+	if (wrap->line_count == wrap->line_capacity) {
+		wrap->line_capacity = wrap->line_capacity ? wrap->line_capacity * 2 : 8;
+		wrap->lines = ISQ_REALLOC(wrap->lines, sizeof(struct isq_ui_wrap_line) * wrap->line_capacity);
+	}
+
+	wrap->lines[wrap->line_count++] = (struct isq_ui_wrap_line){ start, end, width };
+
+	// A line of one word stays a line of its own at
+	// any width.
+	if (words > 1 && width > wrap->min_width)
+		wrap->min_width = width;
+	if (width > wrap->max_line_width)
+		wrap->max_line_width = width;
+}
+
+// Greedy word wrap of one paragraph (no '\n') of
+// length bytes at width. Words wider than width
+// get a line of their own. Also records the range
+// of widths that give the same lines, so that
+// resizing only rewraps the paragraphs that change.
+static void isq_ui_wrap_paragraph(struct isq_ui_font font, const char *text, unsigned length, float width, struct isq_ui_wrap *wrap)
+{
+	isq_vec2 pos = {0};
+	ISQ_UI_BAKED_QUAD_TYPE q;
+
+	unsigned line_start = 0;
+	unsigned line_end = 0;
+	unsigned line_words = 0;
+	float line_left = 0;
+	float line_right = 0;
+
+	wrap->line_count = 0;
+	wrap->min_width = 0;
+	wrap->max_width = FLT_MAX;
+	wrap->max_line_width = 0;
+
+	// Spaces are ASCII and never part of a multibyte
+	// sequence, so words are split on bytes.
+	struct isq_ui_text_iter iter = isq_ui_text_iter(text, length);
+	const unsigned char *start = iter.at;
+	unsigned codepoint;
+
+	for (;;) {
+		while (iter.at < iter.end && *iter.at == ' ') {
+			isq_ui_glyph_quad(&font, ' ', &pos, &q, NULL);
+			iter.at++;
+		}
+
+		if (iter.at == iter.end)
+			break;
+
+		unsigned word_start = (unsigned)(iter.at - start);
+		float word_left = pos.x;
+		float word_right = pos.x;
+		int word_glyphs = 0;
+
+		while (iter.at < iter.end && *iter.at != ' ' && isq_ui_text_next(&iter, &codepoint)) {
+			if (!isq_ui_glyph_quad(&font, codepoint, &pos, &q, NULL))
+				continue;
+
+			if (!word_glyphs++)
+				word_left = q.x0;
+			word_right = q.x1;
+		}
+
+		unsigned i = (unsigned)(iter.at - start);
+
+		if (line_words && word_right - line_left <= width) {
+			line_end = i;
+			line_right = word_right;
+			line_words++;
+			continue;
+		}
+
+		if (line_words) {
+			if (word_right - line_left < wrap->max_width)
+				wrap->max_width = word_right - line_left;
+			isq_ui_wrap_push(wrap, line_start, line_end, line_right - line_left, line_words);
+		}
+
+		line_start = word_start;
+		line_end = i;
+		line_left = word_left;
+		line_right = word_right;
+		line_words = 1;
+	}
+
+	if (line_words || wrap->line_count == 0)
+		isq_ui_wrap_push(wrap, line_start, line_end, line_right - line_left, line_words);
+}
+
+// Lines of text wrapped to width. Paragraphs are
+// looked up in the paragraph cache, so when text
+// changes only the paragraphs that changed are
+// wrapped again. The result is owned by the wrap
+// cache, and with ISQ_UI_THREADS is only valid
+// while isq_ui_wrap_mutex is held.
+static const struct isq_ui_wrap *isq_ui_wrap_text(struct isq_ui_font font, const char *text, float width)
+{
+	unsigned length = (unsigned)ISQ_STRLEN(text);
+	isq_ui_key font_key = isq_ui_hash_bytes(0, &font, sizeof(font));
+	isq_ui_key key = isq_ui_hash_bytes(font_key, text, length);
+	struct isq_ui_wrap *wrap = &isq_ui_wrap_cache[key & (ISQ_UI_WRAP_CACHE_SIZE - 1)];
+
+	if (wrap->key == key && width >= wrap->min_width && width < wrap->max_width) {
+		isq_ui_wrap_hits++;
+		return wrap;
+	}
+
+	isq_ui_wrap_misses++;
+
+	wrap->key = key;
+	wrap->line_count = 0;
+	wrap->min_width = 0;
+	wrap->max_width = FLT_MAX;
+	wrap->max_line_width = 0;
+
+	for (unsigned start = 0; start <= length; ) {
+		unsigned end = start;
+		while (end < length && text[end] != '\n')
+			++end;
+
+		isq_ui_key paragraph_key = isq_ui_hash_bytes(font_key, text + start, end - start);
+		struct isq_ui_wrap *paragraph = &isq_ui_wrap_paragraph_cache[paragraph_key & (ISQ_UI_WRAP_CACHE_SIZE - 1)];
+
+		if (paragraph->key != paragraph_key || width < paragraph->min_width || width >= paragraph->max_width) {
+			isq_ui_wrap_paragraph(font, text + start, end - start, width, paragraph);
+			paragraph->key = paragraph_key;
+			isq_ui_wrap_paragraphs++;
+		}
+
+		for (unsigned i = 0; i < paragraph->line_count; ++i) {
+			struct isq_ui_wrap_line line = paragraph->lines[i];
+			line.start += start;
+			line.end += start;
+			isq_ui_wrap_push(wrap, line.start, line.end, line.width, 0);
+		}
+
+		if (paragraph->min_width > wrap->min_width)
+			wrap->min_width = paragraph->min_width;
+		if (paragraph->max_width < wrap->max_width)
+			wrap->max_width = paragraph->max_width;
+
+		start = end + 1;
+	}
+
+	return wrap;
+}
+
+static float isq_ui_compute_width(unsigned id, isq_vec2 origin, isq_vec2 parent_size)
+{
+	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	if (!box)
+		return 0;
+
+	struct isq_ui_size size = isq_ui_box_size_array[id].x;
+
+	if (size.type == ISQ_UI_SIZE_TYPE_PIXELS)
+		return size.value;
+
+	if (size.type == ISQ_UI_SIZE_TYPE_PERCENT)
+		return parent_size.x * size.value;
+
+	if (size.type == ISQ_UI_SIZE_TYPE_TEXT_CONTENT) {
+		float text_width = isq_ui_measure_text(box->style.font, box->text).max_line_width;
+		float padding = box->style.padding.left + box->style.padding.right;
+
+		// Wrapped text is at most as wide as its parent.
+		if ((isq_ui_box_flags_array[id] & ISQ_UI_BOX_FLAG_TEXT_WRAP_WORD) && text_width > parent_size.x - padding)
+			text_width = parent_size.x - padding > 0 ? parent_size.x - padding : 0;
+
+		return text_width + padding;
+	}
+
+	if (size.type == ISQ_UI_SIZE_TYPE_CHILDREN_SUM)
+		return box->children_size.x + box->style.padding.left + box->style.padding.right;
+
+	// ...
+	return 0;
+}
+
+// Number of lines the text of box id takes up.
+static unsigned isq_ui_text_line_count(unsigned id, isq_vec2 origin, isq_vec2 parent_size)
+{
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+
+	if (!(isq_ui_box_flags_array[id] & ISQ_UI_BOX_FLAG_TEXT_WRAP_WORD))
+		return isq_ui_measure_text(box->style.font, box->text).line_count;
+
+	if (!box->text)
+		return 0;
+
+	float width = isq_ui_compute_width(id, origin, parent_size) - box->style.padding.left - box->style.padding.right;
+
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_lock(&isq_ui_wrap_mutex);
+#endif
+	unsigned line_count = isq_ui_wrap_text(box->style.font, box->text, width)->line_count;
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_unlock(&isq_ui_wrap_mutex);
+#endif
+
+	return line_count;
+}
+
+static float isq_ui_compute_height(unsigned id, isq_vec2 origin, isq_vec2 parent_size)
+{
+	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	if (!box)
+		return 0;
+
+	struct isq_ui_size size = isq_ui_box_size_array[id].y;
+
+	if (size.type == ISQ_UI_SIZE_TYPE_PIXELS)
+		return size.value;
+
+	if (size.type == ISQ_UI_SIZE_TYPE_PERCENT)
+		return parent_size.y * size.value;
+
+	if (size.type == ISQ_UI_SIZE_TYPE_TEXT_CONTENT) {
+		unsigned line_count = isq_ui_text_line_count(id, origin, parent_size);
+		line_count = line_count ? line_count : 1;
+		return box->style.font.size * line_count + box->style.padding.top + box->style.padding.bottom;
+	}
+
+	if (size.type == ISQ_UI_SIZE_TYPE_CHILDREN_SUM)
+		return box->children_size.y + box->style.padding.top + box->style.padding.bottom;
 
-			while (text && *text) {
-				if (*text < 32) {
-					++text;
-					continue;
-				}
+	return 0;
+}
 
-				ISQ_UI_BAKED_QUAD(box->style.font.character_data, 512, 512, *text-32, &pos.x, &pos.y, &q, 1);
+// isq_ui_compute_width and isq_ui_compute_height
+// in one call. Text content sizes walk every glyph, so they
+// are cached by everything they depend on. Other
+// sizes are cheaper to compute than to hash.
+static isq_vec2 isq_ui_compute_size(unsigned id, isq_vec2 origin, isq_vec2 parent_size)
+{
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	union isq_ui_sizes semantic_size = isq_ui_box_size_array[id];
+
+	if (semantic_size.x.type != ISQ_UI_SIZE_TYPE_TEXT_CONTENT && semantic_size.y.type != ISQ_UI_SIZE_TYPE_TEXT_CONTENT) {
+		return (isq_vec2){
+			isq_ui_compute_width(id, origin, parent_size),
+			isq_ui_compute_height(id, origin, parent_size),
+		};
+	}
 
-				++text;
+	isq_ui_key key = isq_ui_hash_bytes(0, &semantic_size, sizeof(semantic_size));
+	key = isq_ui_hash_bytes(key, &isq_ui_box_flags_array[id], sizeof(enum isq_ui_box_flags));
+	key = isq_ui_hash_bytes(key, &box->style.padding, sizeof(box->style.padding));
+	key = isq_ui_hash_bytes(key, &box->style.font, sizeof(box->style.font));
+	key = isq_ui_hash_bytes(key, &parent_size, sizeof(parent_size));
+	if (semantic_size.x.type == ISQ_UI_SIZE_TYPE_CHILDREN_SUM || semantic_size.y.type == ISQ_UI_SIZE_TYPE_CHILDREN_SUM)
+		key = isq_ui_hash_bytes(key, &box->children_size, sizeof(box->children_size));
+	if (box->text)
+		key = isq_ui_hash_bytes(key, box->text, ISQ_STRLEN(box->text));
+	key = key ? key : 1;
+
+	unsigned index = (unsigned)key & (ISQ_UI_SIZE_CACHE_SIZE - 1);
+	struct isq_ui_size_cache_entry *entry = &isq_ui_size_cache[index];
+	struct isq_ui_size_cache_stripe *stripe = &isq_ui_size_cache_stripes[index % ISQ_UI_SIZE_CACHE_STRIPES];
+	isq_vec2 size;
+
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_lock(&stripe->mutex);
+#endif
+	int hit = entry->key == key;
+	if (hit) {
+		size = entry->size;
+		stripe->hits++;
+	} else {
+		stripe->misses++;
+	}
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_unlock(&stripe->mutex);
+#endif
 
-				isq_vec4 text_rect = (isq_vec4){q.x0, q.y0 + box->style.font.size * 0.75, q.x1, q.y1 + box->style.font.size * 0.75};
-				isq_vec4 text_uvs = (isq_vec4){q.s0, q.t0, q.s1, q.t1};
+	if (hit)
+		return size;
 
-				if (box->parent && box->parent->flags & ISQ_UI_BOX_FLAG_SCROLL_VERTICAL) {
-					if (text_rect.w > box->parent->computed_rect.w) {
-						float size = text_rect.w - text_rect.y;
-						float pct = (box->parent->computed_rect.w - text_rect.y) / size;
+	size.x = isq_ui_compute_width(id, origin, parent_size);
+	size.y = isq_ui_compute_height(id, origin, parent_size);
 
-						text_rect.w = box->parent->computed_rect.w;
-						text_uvs.w = q.t0 + (q.t1 - q.t0) * pct;
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_lock(&stripe->mutex);
+#endif
+	entry->key = key;
+	entry->size = size;
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_unlock(&stripe->mutex);
+#endif
 
-						if (text_rect.w > box->parent->computed_rect.w)
-							text_rect.w = box->parent->computed_rect.w;
-						
-						if (text_rect.y > box->parent->computed_rect.w)
-							text_rect.y = box->parent->computed_rect.w;
-					}
+	return size;
+}
 
-					if (cutoff_top) {
-						float size = text_rect.w - text_rect.y;
-						float pct = 1.0;
+// Hash of everything isq_ui_compute_rect reads.
+// Floats are hashed by their bits, so only
+// bit-identical inputs match.
+static isq_ui_key isq_ui_layout_hash(unsigned id, isq_vec2 origin, isq_vec2 parent_size)
+{
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	union isq_ui_sizes semantic_size = isq_ui_box_size_array[id];
+	unsigned parent = isq_ui_box_parent_array[id];
+
+	isq_ui_key hash = isq_ui_hash_bytes(0, &isq_ui_box_flags_array[id], sizeof(enum isq_ui_box_flags));
+	hash = isq_ui_hash_bytes(hash, &semantic_size, sizeof(semantic_size));
+	hash = isq_ui_hash_bytes(hash, &box->position, sizeof(box->position));
+	hash = isq_ui_hash_bytes(hash, &box->style.padding, sizeof(box->style.padding));
+	hash = isq_ui_hash_bytes(hash, &origin, sizeof(origin));
+	hash = isq_ui_hash_bytes(hash, &parent_size, sizeof(parent_size));
+
+	if (semantic_size.x.type == ISQ_UI_SIZE_TYPE_TEXT_CONTENT || semantic_size.y.type == ISQ_UI_SIZE_TYPE_TEXT_CONTENT) {
+		hash = isq_ui_hash_bytes(hash, &box->style.font, sizeof(box->style.font));
+		if (box->text)
+			hash = isq_ui_hash_bytes(hash, box->text, ISQ_STRLEN(box->text));
+	}
 
-						printf("size: %f pct: %f\n", size, pct);
+	if (semantic_size.x.type == ISQ_UI_SIZE_TYPE_CHILDREN_SUM || semantic_size.y.type == ISQ_UI_SIZE_TYPE_CHILDREN_SUM)
+		hash = isq_ui_hash_bytes(hash, &box->children_size, sizeof(box->children_size));
 
-						text_rect.y -= cutoff_size;
-						text_rect.w -= cutoff_size;
+	hash = isq_ui_hash_bytes(hash, &box->scroll_height, sizeof(box->scroll_height));
 
-						if (text_rect.y < box->parent->computed_rect.y)
-							text_rect.y = box->parent->computed_rect.y;
+	// Flex layout places the box after its previous
+	// sibling and bumps the parent's flex state.
+	if (parent != ISQ_UI_ID_NONE) {
+		hash = isq_ui_hash_bytes(hash, &isq_ui_box_flags_array[parent], sizeof(enum isq_ui_box_flags));
+		hash = isq_ui_hash_bytes(hash, &isq_ui_box_rect_array[parent], sizeof(isq_vec4));
+		hash = isq_ui_hash_bytes(hash, &isq_ui_box_array[parent].style.flex_gap, sizeof(float));
+		hash = isq_ui_hash_bytes(hash, &isq_ui_box_array[parent].flex_size, sizeof(float));
+		hash = isq_ui_hash_bytes(hash, &isq_ui_box_array[parent].flex_count, sizeof(unsigned));
+	}
 
-						if (text_rect.w < box->parent->computed_rect.y)
-							text_rect.w = box->parent->computed_rect.y;
+	if (box->prev_sibling != ISQ_UI_ID_NONE)
+		hash = isq_ui_hash_bytes(hash, &isq_ui_box_rect_array[box->prev_sibling], sizeof(isq_vec4));
 
-						// TODO: Update uvs to match new size.
-						text_uvs.w = q.t0 + (q.t1 - q.t0) * pct;
-					}
-				}
+	return hash ? hash : 1;
+}
 
-				isq_ui_enqueue_rect(text_rect, text_uvs, box->style.text_color, box->style.font.texture_index);
+// Hash of the inputs of box id that it and its
+// descendants are laid out from, other than its
+// parent's rect, seeded with the hashes of its
+// children.
+static isq_ui_key isq_ui_subtree_hash(unsigned id)
+{
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	union isq_ui_sizes semantic_size = isq_ui_box_size_array[id];
+
+	isq_ui_key hash = isq_ui_hash_bytes(box->subtree_hash, &isq_ui_box_flags_array[id], sizeof(enum isq_ui_box_flags));
+	hash = isq_ui_hash_bytes(hash, &semantic_size, sizeof(semantic_size));
+	hash = isq_ui_hash_bytes(hash, &box->position, sizeof(box->position));
+	hash = isq_ui_hash_bytes(hash, &box->style.padding, sizeof(box->style.padding));
+	hash = isq_ui_hash_bytes(hash, &box->style.flex_gap, sizeof(box->style.flex_gap));
+	hash = isq_ui_hash_bytes(hash, &box->scroll_height, sizeof(box->scroll_height));
+
+	if (semantic_size.x.type == ISQ_UI_SIZE_TYPE_TEXT_CONTENT || semantic_size.y.type == ISQ_UI_SIZE_TYPE_TEXT_CONTENT) {
+		hash = isq_ui_hash_bytes(hash, &box->style.font, sizeof(box->style.font));
+		if (box->text)
+			hash = isq_ui_hash_bytes(hash, box->text, ISQ_STRLEN(box->text));
+	}
+
+	return hash ? hash : 1;
+}
+
+// Only touches the box, its retained entry and
+// the flex state of its parent, so the children
+// of different boxes can be laid out in
+// parallel.
+static enum isq_ui_layout_result isq_ui_compute_rect(unsigned id)
+{
+	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	if (box == NULL)
+		return ISQ_UI_LAYOUT_RESULT_SKIPPED;
+
+	union isq_ui_sizes semantic_size = isq_ui_box_size_array[id];
+
+	if ((box->position.x == (float)ISQ_UI_MAGIC_NUMBERF && box->position.y == (float)ISQ_UI_MAGIC_NUMBERF) || (semantic_size.x.type == ISQ_UI_SIZE_TYPE_NULL && semantic_size.y.type == ISQ_UI_SIZE_TYPE_NULL))
+		return ISQ_UI_LAYOUT_RESULT_SKIPPED;
+
+	enum isq_ui_box_flags flags = isq_ui_box_flags_array[id];
+	isq_vec4 *rect = &isq_ui_box_rect_array[id];
+
+	unsigned parent_id = isq_ui_box_parent_array[id];
+	struct isq_ui_box *parent = isq_ui_box_array_get(parent_id);
+	enum isq_ui_box_flags parent_flags = parent ? isq_ui_box_flags_array[parent_id] : 0;
+	isq_vec4 parent_rect = parent ? isq_ui_box_rect_array[parent_id] : (isq_vec4){0};
+	isq_vec4 *prev_sibling_rect = box->prev_sibling != ISQ_UI_ID_NONE ? &isq_ui_box_rect_array[box->prev_sibling] : NULL;
+
+	isq_vec2 origin = { 0, 0 };
+	isq_vec2 parent_size = isq_ui_dimensions;
+
+	if (parent) {
+		origin.x = parent_rect.x + parent->style.padding.left;
+		origin.y = parent_rect.y + parent->style.padding.top;
+		parent_size.x = parent_rect.z - parent_rect.x - parent->style.padding.left - parent->style.padding.right;
+		parent_size.y = parent_rect.w - parent_rect.y - parent->style.padding.top - parent->style.padding.bottom;
+	}
+
+	// Keyed boxes reuse an earlier layout when
+	// nothing it depends on has changed. Deferred
+	// layout skips their whole subtree as well if
+	// it did not change, see isq_ui_subtree_layout.
+	struct isq_ui_retained *retained = NULL;
+	isq_ui_key hash = 0;
+
+	if (box->retained != ISQ_UI_RETAINED_NONE) {
+		retained = &isq_ui_retained_array[box->retained];
+		hash = isq_ui_layout_hash(id, origin, parent_size);
+
+		for (unsigned i = 0; i < ISQ_UI_LAYOUT_HISTORY; ++i) {
+			struct isq_ui_layout *layout = &retained->layout[i];
+			if (layout->hash != hash)
+				continue;
+
+			*rect = layout->computed_rect;
+			box->scroll_offset_max = layout->scroll_offset_max;
+			if (parent) {
+				parent->flex_size = layout->parent_flex_size;
+				parent->flex_count = layout->parent_flex_count;
 			}
+
+			return ISQ_UI_LAYOUT_RESULT_REUSED;
 		}
 	}
 
-	ISQ_UI_RENDER_RECT(isq_ui_vertex_buffer, isq_ui_vertex_buffer_count);
+	isq_vec2 size = isq_ui_compute_size(id, origin, parent_size);
+	float width = size.x + box->style.padding.left + box->style.padding.right;
+	float height = size.y + box->style.padding.top + box->style.padding.bottom;
+
+	box->scroll_offset_max = height;
+	if (box->scroll_height > 0) {
+		float visible = height - box->style.padding.top - box->style.padding.bottom;
+		box->scroll_offset_max = box->scroll_height > visible ? box->scroll_height - visible : 0;
+	}
+
+	isq_vec2 position = {origin.x + box->position.x, origin.y + box->position.y};
+
+	if (flags & ISQ_UI_BOX_FLAG_POSITION_ABSOLUTE) {
+		position.x = box->position.x;
+		position.y = box->position.y;
+	} else if (parent_flags & ISQ_UI_BOX_FLAG_FLEX_ROW) {
+		if (height > parent->flex_size)
+			parent->flex_size = height;
+
+		if (prev_sibling_rect) {
+			position.x = prev_sibling_rect->z + parent->style.flex_gap;
+
+			if (position.x >= parent_rect.z) {
+				position.x = parent_rect.x;
+				parent->flex_count += 1;
+			}
+
+			position.y += parent->flex_count * parent->flex_size;
+		}
+	} else if (parent_flags & ISQ_UI_BOX_FLAG_FLEX_COLUMN) {
+		if (width > parent->flex_size)
+			parent->flex_size = width;
+
+		if (prev_sibling_rect) {
+			position.y = prev_sibling_rect->w + parent->style.flex_gap;
+
+			if (position.y >= parent_rect.w && !(parent_flags & ISQ_UI_BOX_FLAG_FLEX_NOWRAP)) {
+				position.y = parent_rect.y;
+				parent->flex_count += 1;
+			}
+
+			position.x += parent->flex_count * parent->flex_size;
+		}
+	}
+
+
+	// TODO: Add other types of position... (percentage based, for example)
+	rect->x = position.x;
+	rect->y = position.y;
+
+	rect->z = rect->x + width - box->style.padding.left - box->style.padding.right;
+	rect->w = rect->y + height - box->style.padding.top - box->style.padding.bottom;
+
+	if (retained) {
+		struct isq_ui_layout *layout = &retained->layout[retained->layout_next];
+		retained->layout_next = (retained->layout_next + 1) % ISQ_UI_LAYOUT_HISTORY;
+
+		layout->hash = hash;
+		layout->computed_rect = *rect;
+		layout->scroll_offset_max = box->scroll_offset_max;
+		if (parent) {
+			layout->parent_flex_size = parent->flex_size;
+			layout->parent_flex_count = parent->flex_count;
+		}
+	}
+
+	return ISQ_UI_LAYOUT_RESULT_COMPUTED;
 }
 
-static float get_text_width_in_pixels(struct isq_ui_font font, const char *text)
+static void isq_ui_count_layout(struct isq_ui_stats *stats, enum isq_ui_layout_result result)
 {
-	float width_start = ISQ_UI_MAGIC_NUMBERF;
-	isq_vec2 pos = {0};
-	ISQ_UI_BAKED_QUAD_TYPE q;
+	if (result == ISQ_UI_LAYOUT_RESULT_COMPUTED)
+		stats->layout_computed++;
+	else if (result == ISQ_UI_LAYOUT_RESULT_REUSED)
+		stats->layout_reused++;
+}
 
-	while (text && *text) {
-		if (*text < 32) {
-			// TODO: Next line, line count.
-			++text;
-			continue;
+// Templates and stored subtrees only apply to
+// subtrees stored right after their root, which
+// is what building them with isq_ui_push gives.
+// Boxes come after their parent, so that is when
+// the last one is subtree_count - 1 past the root.
+static int isq_ui_subtree_is_contiguous(unsigned id)
+{
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	return box->subtree_end == id + box->subtree_count;
+}
+
+// Everything about the template box itself that
+// its children can depend on.
+static isq_ui_key isq_ui_template_key(unsigned id)
+{
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	isq_vec4 rect = isq_ui_box_rect_array[id];
+	isq_vec2 size = { rect.z - rect.x, rect.w - rect.y };
+
+	isq_ui_key key = isq_ui_hash_bytes(box->layout_template, &size, sizeof(size));
+	key = isq_ui_hash_bytes(key, &isq_ui_box_flags_array[id], sizeof(enum isq_ui_box_flags));
+	key = isq_ui_hash_bytes(key, &box->style.padding, sizeof(box->style.padding));
+	key = isq_ui_hash_bytes(key, &box->style.flex_gap, sizeof(box->style.flex_gap));
+	key = isq_ui_hash_bytes(key, &box->subtree_count, sizeof(box->subtree_count));
+
+	return key ? key : 1;
+}
+
+static int isq_ui_template_load(unsigned id, isq_ui_key key)
+{
+	struct isq_ui_template *entry = &isq_ui_template_cache[key & (ISQ_UI_TEMPLATE_CACHE_SIZE - 1)];
+	unsigned count = isq_ui_box_array[id].subtree_count - 1;
+	isq_vec4 origin = isq_ui_box_rect_array[id];
+	int hit;
+
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_lock(&isq_ui_template_mutex);
+#endif
+	hit = entry->key == key && entry->count == count;
+	if (hit) {
+		for (unsigned i = 0; i < count; ++i) {
+			struct isq_ui_template_box *cached = &entry->boxes[i];
+			isq_ui_box_rect_array[id + 1 + i] = (isq_vec4){
+				cached->rect.x + origin.x,
+				cached->rect.y + origin.y,
+				cached->rect.z + origin.x,
+				cached->rect.w + origin.y,
+			};
+			isq_ui_box_array[id + 1 + i].scroll_offset_max = cached->scroll_offset_max;
 		}
+	}
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_unlock(&isq_ui_template_mutex);
+#endif
+
+	return hit;
+}
 
-		ISQ_UI_BAKED_QUAD(font.character_data, 512, 512, *text-32, &pos.x, &pos.y, &q, 1);
+static void isq_ui_template_store(unsigned id, isq_ui_key key)
+{
+	struct isq_ui_template *entry = &isq_ui_template_cache[key & (ISQ_UI_TEMPLATE_CACHE_SIZE - 1)];
+	unsigned count = isq_ui_box_array[id].subtree_count - 1;
+	isq_vec4 origin = isq_ui_box_rect_array[id];
+
+	// Absolute boxes don't move with the template.
+	for (unsigned i = id + 1; i <= id + count; ++i) {
+		if (isq_ui_box_flags_array[i] & ISQ_UI_BOX_FLAG_POSITION_ABSOLUTE)
+			return;
+	}
 
-		if (width_start == ISQ_UI_MAGIC_NUMBERF)
-			width_start = q.x0;
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_lock(&isq_ui_template_mutex);
+#endif
+	if (entry->capacity < count) {
+		entry->capacity = count;
+		entry->boxes = ISQ_REALLOC(entry->boxes, sizeof(struct isq_ui_template_box) * count);
+	}
 
-		++text;
+	for (unsigned i = 0; i < count; ++i) {
+		isq_vec4 rect = isq_ui_box_rect_array[id + 1 + i];
+		entry->boxes[i].rect = (isq_vec4){
+			rect.x - origin.x,
+			rect.y - origin.y,
+			rect.z - origin.x,
+			rect.w - origin.y,
+		};
+		entry->boxes[i].scroll_offset_max = isq_ui_box_array[id + 1 + i].scroll_offset_max;
 	}
 
-	return q.x1 - width_start;
+	entry->key = key;
+	entry->count = count;
+#ifdef ISQ_UI_THREADS
+	isq_ui_mutex_unlock(&isq_ui_template_mutex);
+#endif
 }
 
-static float isq_ui_compute_width(unsigned id, isq_vec2 origin, isq_vec2 parent_size)
+static void isq_ui_layout_range(unsigned first, unsigned end, struct isq_ui_stats *stats);
+
+// Restore the descendants of a keyed box whose
+// own rect is known from its last layout, if
+// nothing in its subtree changed. Returns 0 if
+// they still need laying out, which
+// isq_ui_subtree_store then stores.
+static int isq_ui_subtree_layout(unsigned id, struct isq_ui_stats *stats)
 {
-	struct isq_ui_box *box = isq_ui_box_array_get(id);
-	if (!box)
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	if (box->retained == ISQ_UI_RETAINED_NONE || box->subtree_count < 2 || !isq_ui_subtree_is_contiguous(id))
+		return 0;
+
+	struct isq_ui_retained *retained = &isq_ui_retained_array[box->retained];
+	unsigned count = box->subtree_count - 1;
+
+	isq_ui_key key = isq_ui_hash_bytes(box->subtree_hash, &isq_ui_box_rect_array[id], sizeof(isq_vec4));
+	key = key ? key : 1;
+
+	if (retained->subtree_key != key || retained->subtree_count != count) {
+		box->subtree_key = key;
+		stats->subtree_misses++;
+		return 0;
+	}
+
+	for (unsigned i = 0; i < count; ++i) {
+		isq_ui_box_rect_array[id + 1 + i] = retained->subtree[i].rect;
+		isq_ui_box_array[id + 1 + i].scroll_offset_max = retained->subtree[i].scroll_offset_max;
+	}
+
+	stats->subtree_hits++;
+	return 1;
+}
+
+// Store the descendants of keyed boxes laid out
+// this frame. Runs before isq_ui_clip moves
+// scrolled boxes, since the scroll offset is not
+// part of the layout.
+static void isq_ui_subtree_store(void)
+{
+	for (unsigned i = 0; i < isq_ui_box_array_count; ++i) {
+		struct isq_ui_box *box = &isq_ui_box_array[i];
+		if (!box->subtree_key)
+			continue;
+
+		struct isq_ui_retained *retained = &isq_ui_retained_array[box->retained];
+		unsigned count = box->subtree_count - 1;
+		if (retained->subtree_capacity < count) {
+			retained->subtree_capacity = count;
+			retained->subtree = ISQ_REALLOC(retained->subtree, sizeof(struct isq_ui_template_box) * count);
+		}
+
+		for (unsigned j = 0; j < count; ++j) {
+			retained->subtree[j].rect = isq_ui_box_rect_array[i + 1 + j];
+			retained->subtree[j].scroll_offset_max = isq_ui_box_array[i + 1 + j].scroll_offset_max;
+		}
+
+		retained->subtree_key = box->subtree_key;
+		retained->subtree_count = count;
+	}
+}
+
+// Lay out the descendants of a template box whose
+// own rect is known. Returns 0 if the box is not
+// one, and its subtree still needs laying out.
+static int isq_ui_template_layout(unsigned id, struct isq_ui_stats *stats)
+{
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	if (!box->layout_template || box->subtree_count < 2 || !isq_ui_subtree_is_contiguous(id))
 		return 0;
 
-	if (box->semantic_size.x.type == ISQ_UI_SIZE_TYPE_PIXELS)
-		return box->semantic_size.x.value;
+	isq_ui_key key = isq_ui_template_key(id);
+
+	if (isq_ui_template_load(id, key)) {
+		stats->template_hits++;
+	} else {
+		isq_ui_layout_range(id + 1, id + box->subtree_count, stats);
+		isq_ui_template_store(id, key);
+		stats->template_misses++;
+	}
+
+	return 1;
+}
+
+// Lay out the boxes in [first, end) in order.
+static void isq_ui_layout_range(unsigned first, unsigned end, struct isq_ui_stats *stats)
+{
+	for (unsigned i = first; i < end; ++i) {
+		isq_ui_count_layout(stats, isq_ui_compute_rect(i));
+
+		if (isq_ui_subtree_layout(i, stats) || isq_ui_template_layout(i, stats))
+			i += isq_ui_box_array[i].subtree_count - 1;
+	}
+}
+
+// Expand the box arrays if needed. New slots are
+// zeroed so that the first frame's hit testing
+// sees empty rects.
+static void isq_ui_box_array_reserve(void)
+{
+	if (isq_ui_box_array_count < isq_ui_box_array_capacity)
+		return;
+
+	unsigned old_capacity = isq_ui_box_array_capacity;
+	isq_ui_box_array_capacity = old_capacity ? old_capacity * 2 : ISQ_UI_INITIAL_BUFFER_CAPACITY;
+	unsigned added = isq_ui_box_array_capacity - old_capacity;
+
+	isq_ui_box_array = ISQ_REALLOC(isq_ui_box_array, sizeof(struct isq_ui_box) * isq_ui_box_array_capacity);
+	isq_ui_box_flags_array = ISQ_REALLOC(isq_ui_box_flags_array, sizeof(enum isq_ui_box_flags) * isq_ui_box_array_capacity);
+	isq_ui_box_parent_array = ISQ_REALLOC(isq_ui_box_parent_array, sizeof(unsigned) * isq_ui_box_array_capacity);
+	isq_ui_box_rect_array = ISQ_REALLOC(isq_ui_box_rect_array, sizeof(isq_vec4) * isq_ui_box_array_capacity);
+	isq_ui_box_size_array = ISQ_REALLOC(isq_ui_box_size_array, sizeof(union isq_ui_sizes) * isq_ui_box_array_capacity);
+	isq_ui_box_clip_array = ISQ_REALLOC(isq_ui_box_clip_array, sizeof(isq_vec4) * isq_ui_box_array_capacity);
+	isq_ui_box_visible_array = ISQ_REALLOC(isq_ui_box_visible_array, isq_ui_box_array_capacity);
+
+	memset(isq_ui_box_array + old_capacity, 0, sizeof(struct isq_ui_box) * added);
+	memset(isq_ui_box_flags_array + old_capacity, 0, sizeof(enum isq_ui_box_flags) * added);
+	memset(isq_ui_box_parent_array + old_capacity, 0, sizeof(unsigned) * added);
+	memset(isq_ui_box_rect_array + old_capacity, 0, sizeof(isq_vec4) * added);
+	memset(isq_ui_box_size_array + old_capacity, 0, sizeof(union isq_ui_sizes) * added);
+	memset(isq_ui_box_clip_array + old_capacity, 0, sizeof(isq_vec4) * added);
+	memset(isq_ui_box_visible_array + old_capacity, 0, added);
+}
+
+// Called by setters that change layout inputs.
+static void isq_ui_relayout(unsigned id)
+{
+	if (isq_ui_current_layout_mode == ISQ_UI_LAYOUT_IMMEDIATE)
+		isq_ui_count_layout(&isq_ui_stats, isq_ui_compute_rect(id));
+}
+
+#ifdef ISQ_UI_THREADS
+// Work stealing pool for parallel layout. A task
+// is the id of a box whose children still need
+// laying out. Each worker pushes and pops tasks
+// at the bottom of its own queue, and idle
+// workers steal from the top of the others'.
+// Worker 0 is the thread calling isq_ui_end.
+#ifndef ISQ_UI_LAYOUT_QUEUE_SIZE
+#define ISQ_UI_LAYOUT_QUEUE_SIZE 1024
+#endif
+
+struct isq_ui_worker {
+	isq_ui_mutex mutex;
+	unsigned tasks[ISQ_UI_LAYOUT_QUEUE_SIZE];
+	unsigned top;
+	unsigned bottom;
+
+	struct isq_ui_stats stats;
+};
+
+static struct isq_ui_worker isq_ui_workers[ISQ_UI_LAYOUT_THREADS];
+static int isq_ui_pool_started = 0;
+static isq_ui_mutex isq_ui_pool_mutex;
+static isq_ui_cond isq_ui_pool_cond;
+static unsigned isq_ui_pool_generation = 0;
+// Tasks queued or running. Layout is done when
+// this drops to 0.
+static volatile long isq_ui_pool_pending = 0;
+
+static int isq_ui_worker_push(unsigned worker, unsigned id)
+{
+	struct isq_ui_worker *w = &isq_ui_workers[worker];
+	int pushed = 0;
+
+	isq_ui_mutex_lock(&w->mutex);
+	if (w->bottom - w->top < ISQ_UI_LAYOUT_QUEUE_SIZE) {
+		w->tasks[w->bottom++ % ISQ_UI_LAYOUT_QUEUE_SIZE] = id;
+		pushed = 1;
+	}
+	isq_ui_mutex_unlock(&w->mutex);
+
+	return pushed;
+}
+
+static int isq_ui_worker_pop(unsigned worker, unsigned *id)
+{
+	struct isq_ui_worker *w = &isq_ui_workers[worker];
+	int popped = 0;
+
+	isq_ui_mutex_lock(&w->mutex);
+	if (w->bottom != w->top) {
+		*id = w->tasks[--w->bottom % ISQ_UI_LAYOUT_QUEUE_SIZE];
+		popped = 1;
+	}
+	isq_ui_mutex_unlock(&w->mutex);
+
+	return popped;
+}
+
+static int isq_ui_worker_steal(unsigned worker, unsigned *id)
+{
+	for (unsigned i = 1; i < ISQ_UI_LAYOUT_THREADS; ++i) {
+		struct isq_ui_worker *w = &isq_ui_workers[(worker + i) % ISQ_UI_LAYOUT_THREADS];
+		int stolen = 0;
+
+		isq_ui_mutex_lock(&w->mutex);
+		if (w->bottom != w->top) {
+			*id = w->tasks[w->top++ % ISQ_UI_LAYOUT_QUEUE_SIZE];
+			stolen = 1;
+		}
+		isq_ui_mutex_unlock(&w->mutex);
+
+		if (stolen)
+			return 1;
+	}
+
+	return 0;
+}
+
+// Lay out the children of id (the roots for
+// ISQ_UI_ID_NONE), then their subtrees. Siblings
+// depend on each other through flex layout so
+// they stay on one thread, but their subtrees
+// only depend on them.
+static void isq_ui_layout_children(unsigned worker, unsigned id)
+{
+	struct isq_ui_worker *w = &isq_ui_workers[worker];
+	unsigned first = id == ISQ_UI_ID_NONE ? isq_ui_root_first : isq_ui_box_array[id].first_child;
+
+	for (unsigned child = first; child != ISQ_UI_ID_NONE; child = isq_ui_box_array[child].next_sibling) {
+		isq_ui_count_layout(&w->stats, isq_ui_compute_rect(child));
+	}
+
+	for (unsigned child = first; child != ISQ_UI_ID_NONE; child = isq_ui_box_array[child].next_sibling) {
+		struct isq_ui_box *box = &isq_ui_box_array[child];
+		if (box->first_child == ISQ_UI_ID_NONE || isq_ui_subtree_layout(child, &w->stats) || isq_ui_template_layout(child, &w->stats))
+			continue;
+
+		if (box->subtree_count >= ISQ_UI_PARALLEL_LAYOUT_THRESHOLD) {
+			ISQ_UI_ATOMIC_ADD(&isq_ui_pool_pending, 1);
+			if (isq_ui_worker_push(worker, child))
+				continue;
+			ISQ_UI_ATOMIC_ADD(&isq_ui_pool_pending, -1);
+		}
+
+		isq_ui_layout_children(worker, child);
+	}
+}
+
+static void isq_ui_pool_work(unsigned worker)
+{
+	unsigned id;
+
+	while (ISQ_UI_ATOMIC_LOAD(&isq_ui_pool_pending) > 0) {
+		if (isq_ui_worker_pop(worker, &id) || isq_ui_worker_steal(worker, &id)) {
+			isq_ui_layout_children(worker, id);
+			ISQ_UI_ATOMIC_ADD(&isq_ui_pool_pending, -1);
+		} else {
+			isq_ui_thread_yield();
+		}
+	}
+}
+
+static void isq_ui_pool_worker(unsigned worker)
+{
+	unsigned generation = 0;
+
+	for (;;) {
+		isq_ui_mutex_lock(&isq_ui_pool_mutex);
+		while (isq_ui_pool_generation == generation)
+			isq_ui_cond_wait(&isq_ui_pool_cond, &isq_ui_pool_mutex);
+		generation = isq_ui_pool_generation;
+		isq_ui_mutex_unlock(&isq_ui_pool_mutex);
+
+		isq_ui_pool_work(worker);
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI isq_ui_pool_thread(LPVOID arg)
+{
+	isq_ui_pool_worker((unsigned)(unsigned long long)arg);
+	return 0;
+}
+#else
+static void *isq_ui_pool_thread(void *arg)
+{
+	isq_ui_pool_worker((unsigned)(unsigned long long)arg);
+	return NULL;
+}
+#endif
+
+static void isq_ui_pool_start(void)
+{
+	isq_ui_mutex_init(&isq_ui_pool_mutex);
+	isq_ui_cond_init(&isq_ui_pool_cond);
+
+	for (unsigned i = 0; i < ISQ_UI_LAYOUT_THREADS; ++i)
+		isq_ui_mutex_init(&isq_ui_workers[i].mutex);
+
+	for (unsigned long long i = 1; i < ISQ_UI_LAYOUT_THREADS; ++i) {
+#ifdef _WIN32
+		CloseHandle(CreateThread(NULL, 0, isq_ui_pool_thread, (LPVOID)i, 0, NULL));
+#else
+		pthread_t thread;
+		pthread_create(&thread, NULL, isq_ui_pool_thread, (void *)i);
+		pthread_detach(thread);
+#endif
+	}
+
+	isq_ui_pool_started = 1;
+}
+
+// Top down pass of isq_ui_layout on the pool.
+static void isq_ui_layout_parallel(void)
+{
+	if (!isq_ui_pool_started)
+		isq_ui_pool_start();
+
+	for (unsigned i = 0; i < ISQ_UI_LAYOUT_THREADS; ++i)
+		memset(&isq_ui_workers[i].stats, 0, sizeof(struct isq_ui_stats));
+
+	// Hold a pending task while the roots are laid
+	// out, so that workers woken early don't see 0
+	// and go back to sleep.
+	ISQ_UI_ATOMIC_ADD(&isq_ui_pool_pending, 1);
+
+	isq_ui_mutex_lock(&isq_ui_pool_mutex);
+	isq_ui_pool_generation++;
+	isq_ui_cond_broadcast(&isq_ui_pool_cond);
+	isq_ui_mutex_unlock(&isq_ui_pool_mutex);
+
+	isq_ui_layout_children(0, ISQ_UI_ID_NONE);
+	ISQ_UI_ATOMIC_ADD(&isq_ui_pool_pending, -1);
+	isq_ui_pool_work(0);
+
+	for (unsigned i = 0; i < ISQ_UI_LAYOUT_THREADS; ++i) {
+		struct isq_ui_stats *stats = &isq_ui_workers[i].stats;
+		isq_ui_stats.layout_computed += stats->layout_computed;
+		isq_ui_stats.layout_reused += stats->layout_reused;
+		isq_ui_stats.template_hits += stats->template_hits;
+		isq_ui_stats.template_misses += stats->template_misses;
+		isq_ui_stats.subtree_hits += stats->subtree_hits;
+		isq_ui_stats.subtree_misses += stats->subtree_misses;
+	}
+}
+#endif
+
+// Deferred layout. Relies on boxes being created
+// after their parent, which holds for everything
+// built with isq_ui_push, so walking the array
+// backwards visits children before parents and
+// walking it forwards visits parents first.
+static void isq_ui_layout(void)
+{
+	// Bottom up: sizes that depend on children.
+	for (unsigned i = isq_ui_box_array_count; i-- > 0;) {
+		unsigned parent_id = isq_ui_box_parent_array[i];
+		struct isq_ui_box *box = &isq_ui_box_array[i];
+
+		// The children are done, so their hashes are
+		// already folded into this one.
+		if (box->retained != ISQ_UI_RETAINED_NONE || box->keyed_ancestor)
+			box->subtree_hash = isq_ui_subtree_hash(i);
+
+		if (parent_id != ISQ_UI_ID_NONE) {
+			struct isq_ui_box *parent = &isq_ui_box_array[parent_id];
+			parent->subtree_count += box->subtree_count;
+			if (box->subtree_end > parent->subtree_end)
+				parent->subtree_end = box->subtree_end;
+			if (box->keyed_ancestor)
+				parent->subtree_hash = isq_ui_key_combine(parent->subtree_hash, box->subtree_hash);
+		}
+
+		if (parent_id == ISQ_UI_ID_NONE || isq_ui_box_flags_array[i] & ISQ_UI_BOX_FLAG_POSITION_ABSOLUTE)
+			continue;
+
+		union isq_ui_sizes parent_size = isq_ui_box_size_array[parent_id];
+		if (parent_size.x.type != ISQ_UI_SIZE_TYPE_CHILDREN_SUM && parent_size.y.type != ISQ_UI_SIZE_TYPE_CHILDREN_SUM)
+			continue;
+
+		struct isq_ui_box *parent = &isq_ui_box_array[parent_id];
+		enum isq_ui_box_flags parent_flags = isq_ui_box_flags_array[parent_id];
+
+		// Percent sizes are not known until the parent
+		// is, so they count as 0.
+		isq_vec2 size = isq_ui_compute_size(i, (isq_vec2){0}, (isq_vec2){0});
+		float gap = box->prev_sibling != ISQ_UI_ID_NONE ? parent->style.flex_gap : 0;
+
+		if (parent_flags & ISQ_UI_BOX_FLAG_FLEX_ROW) {
+			parent->children_size.x += size.x + gap;
+			if (size.y > parent->children_size.y)
+				parent->children_size.y = size.y;
+		} else if (parent_flags & ISQ_UI_BOX_FLAG_FLEX_COLUMN) {
+			parent->children_size.y += size.y + gap;
+			if (size.x > parent->children_size.x)
+				parent->children_size.x = size.x;
+		} else {
+			isq_vec2 position = box->position;
+			if (position.x == ISQ_UI_MAGIC_NUMBERF && position.y == ISQ_UI_MAGIC_NUMBERF)
+				position = (isq_vec2){0};
+
+			if (position.x + size.x > parent->children_size.x)
+				parent->children_size.x = position.x + size.x;
+			if (position.y + size.y > parent->children_size.y)
+				parent->children_size.y = position.y + size.y;
+		}
+	}
+
+	// Top down: sizes that depend on the parent,
+	// and positions.
+#ifdef ISQ_UI_THREADS
+	if (isq_ui_current_layout_mode == ISQ_UI_LAYOUT_PARALLEL)
+		isq_ui_layout_parallel();
+	else
+		isq_ui_layout_range(0, isq_ui_box_array_count, &isq_ui_stats);
+#else
+	isq_ui_layout_range(0, isq_ui_box_array_count, &isq_ui_stats);
+#endif
+
+	isq_ui_subtree_store();
+}
+
+void isq_ui_init(float width, float height, struct isq_ui_style *style)
+{
+	isq_ui_dimensions.x = width;
+	isq_ui_dimensions.y = height;
+
+	isq_ui_style = *style;
+
+#ifdef ISQ_UI_THREADS
+	for (unsigned i = 0; i < ISQ_UI_SIZE_CACHE_STRIPES; ++i) {
+		isq_ui_mutex_init(&isq_ui_size_cache_stripes[i].mutex);
+		isq_ui_mutex_init(&isq_ui_text_measure_stripes[i].mutex);
+	}
+	isq_ui_mutex_init(&isq_ui_template_mutex);
+	isq_ui_mutex_init(&isq_ui_wrap_mutex);
+	isq_ui_mutex_init(&isq_ui_atlas_mutex);
+#endif
+
+	isq_ui_hit_columns = (unsigned)(width / ISQ_UI_HIT_GRID_CELL_SIZE) + 1;
+	isq_ui_hit_rows = (unsigned)(height / ISQ_UI_HIT_GRID_CELL_SIZE) + 1;
+	isq_ui_hit_cells = ISQ_CALLOC(isq_ui_hit_columns * isq_ui_hit_rows, sizeof(struct isq_ui_hit_cell));
+
+	isq_ui_box_array_reserve();
+	isq_ui_vertex_buffer = ISQ_MALLOC(sizeof(isq_ui_render_vertex) * ISQ_UI_INITIAL_BUFFER_CAPACITY);
+	isq_ui_vertex_buffer_capacity = ISQ_UI_INITIAL_BUFFER_CAPACITY;
+}
+
+void isq_ui_begin(float mouse_x, float mouse_y, int left_down, float scroll_delta)
+{
+	isq_ui_mouse.position.x = mouse_x;
+	isq_ui_mouse.position.y = mouse_y;
+	isq_ui_mouse.left_down = left_down;
+	isq_ui_mouse.scroll_delta = scroll_delta;
+
+	isq_ui_current_parent = ISQ_UI_ID_NONE;
+	isq_ui_root_first = ISQ_UI_ID_NONE;
+	isq_ui_root_last = ISQ_UI_ID_NONE;
+	isq_ui_box_array_count = 0;
+	isq_ui_vertex_buffer_count = 0;
+	isq_ui_command_buffer_count = 0;
+	isq_ui_key_stack_count = 0;
+
+	isq_ui_frame++;
+	isq_ui_retained_collect();
+
+	memset(&isq_ui_stats, 0, sizeof(isq_ui_stats));
+	for (unsigned i = 0; i < ISQ_UI_SIZE_CACHE_STRIPES; ++i) {
+		isq_ui_size_cache_stripes[i].hits = 0;
+		isq_ui_size_cache_stripes[i].misses = 0;
+		isq_ui_text_measure_stripes[i].hits = 0;
+		isq_ui_text_measure_stripes[i].misses = 0;
+	}
+	isq_ui_wrap_hits = 0;
+	isq_ui_wrap_misses = 0;
+	isq_ui_wrap_paragraphs = 0;
 
-	if (box->semantic_size.x.type == ISQ_UI_SIZE_TYPE_PERCENT)
-		return parent_size.x * box->semantic_size.x.value;
+	isq_ui_hit_lookup();
+}
 
-	if (box->semantic_size.x.type == ISQ_UI_SIZE_TYPE_TEXT_CONTENT) {
-		float text_width = get_text_width_in_pixels(box->style.font, box->text);
-		return text_width + box->style.padding.left + box->style.padding.right;
-	}
+void isq_ui_layout_mode(enum isq_ui_layout_mode mode)
+{
+	isq_ui_current_layout_mode = mode;
+}
 
-	// ...
-	return 0;
+void isq_ui_interaction_mode(enum isq_ui_interaction_mode mode)
+{
+	isq_ui_current_interaction_mode = mode;
 }
 
-static float isq_ui_compute_height(unsigned id, isq_vec2 origin, isq_vec2 parent_size)
+// Hit test the rects that were just drawn. The
+// grid is up to date, so the hit id is one from
+// this frame.
+static void isq_ui_resolve(void)
 {
-	struct isq_ui_box *box = isq_ui_box_array_get(id);
-	if (!box)
-		return 0;
+	isq_ui_hit_lookup();
 
-	if (box->semantic_size.y.type == ISQ_UI_SIZE_TYPE_PIXELS)
-		return box->semantic_size.y.value;
+	unsigned id = isq_ui_hit_id;
+	if (id == ISQ_UI_ID_NONE)
+		return;
 
-	if (box->semantic_size.y.type == ISQ_UI_SIZE_TYPE_PERCENT)
-		return parent_size.y * box->semantic_size.y.value;
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	enum isq_ui_box_flags flags = isq_ui_box_flags_array[id];
+	struct isq_ui_state state = {
+		.id = id,
+		.key = box->key,
+		.hovered = (flags & ISQ_UI_BOX_FLAG_HOVERABLE) != 0,
+		.clicked = (flags & ISQ_UI_BOX_FLAG_CLICKABLE) && isq_ui_mouse.left_down > 0,
+	};
 
-	if (box->semantic_size.y.type == ISQ_UI_SIZE_TYPE_TEXT_CONTENT) {
-		return box->style.font.size + box->style.padding.top + box->style.padding.bottom;
-		//return box->style.font.size * box->text_line_count + box->style.padding.top + box->style.padding.bottom;
+	if (box->retained != ISQ_UI_RETAINED_NONE) {
+		isq_ui_retained_array[box->retained].hovered = state.hovered;
+		isq_ui_retained_array[box->retained].clicked = state.clicked;
 	}
 
-	return 0;
+	if (box->on_interact)
+		box->on_interact(state, box->on_interact_user);
 }
 
-static void isq_ui_compute_rect(unsigned id)
+void isq_ui_end(void)
 {
-	struct isq_ui_box *box = isq_ui_box_array_get(id);
-	if (box == NULL)
-		return;
+	if (isq_ui_current_layout_mode != ISQ_UI_LAYOUT_IMMEDIATE)
+		isq_ui_layout();
 
-	if ((box->position.x == (float)ISQ_UI_MAGIC_NUMBERF && box->position.y == (float)ISQ_UI_MAGIC_NUMBERF) || (box->semantic_size.x.type == ISQ_UI_SIZE_TYPE_NULL && box->semantic_size.y.type == ISQ_UI_SIZE_TYPE_NULL))
-		return;
+	// Store after rendering, so that hit testing
+	// next frame sees the rects that were drawn,
+	// the same as unkeyed boxes do.
+	isq_ui_render();
+	isq_ui_retained_store();
+	isq_ui_hit_update();
 
-	float yoffset = 0;
+	if (isq_ui_current_interaction_mode == ISQ_UI_INTERACTION_DEFERRED)
+		isq_ui_resolve();
+}
 
-	isq_vec2 origin = { 0, 0 };
-	isq_vec2 parent_size = isq_ui_dimensions;
+isq_ui_key isq_ui_key_string(const char *string)
+{
+	isq_ui_key hash = isq_ui_hash_bytes(0, string, ISQ_STRLEN(string));
+	return hash ? hash : 1;
+}
 
-	if (box->parent) {
-		origin.x = box->parent->computed_rect.x + box->parent->style.padding.left;
-		origin.y = box->parent->computed_rect.y + box->parent->style.padding.top;
-		parent_size.x = box->parent->computed_rect.z - box->parent->computed_rect.x - box->parent->style.padding.left - box->parent->style.padding.right;
-		parent_size.y = box->parent->computed_rect.w - box->parent->computed_rect.y - box->parent->style.padding.top - box->parent->style.padding.bottom;
-	}
+isq_ui_key isq_ui_key_int(unsigned long long value)
+{
+	return isq_ui_key_combine(0, value);
+}
 
-	float width = isq_ui_compute_width(id, origin, parent_size) + box->style.padding.left + box->style.padding.right;
-	float height = isq_ui_compute_height(id, origin, parent_size) + box->style.padding.top + box->style.padding.bottom;
+unsigned isq_ui_push_key(isq_ui_key key)
+{
+	if (isq_ui_key_stack_count == ISQ_UI_KEY_STACK_SIZE)
+		return 1;
 
-	box->scroll_offset_max = height;
+	isq_ui_key seed = isq_ui_key_stack_count ? isq_ui_key_stack[isq_ui_key_stack_count - 1] : 0;
+	isq_ui_key_stack[isq_ui_key_stack_count++] = isq_ui_key_combine(seed, key);
+	return 0;
+}
 
-	isq_vec2 position = {origin.x + box->position.x, origin.y + box->position.y};
+unsigned isq_ui_pop_key(void)
+{
+	if (isq_ui_key_stack_count == 0)
+		return 1;
 
-	if (box->flags & ISQ_UI_BOX_FLAG_POSITION_ABSOLUTE) {
-		position.x = box->position.x;
-		position.y = box->position.y;
-	} else if (box->parent && box->parent->flags & ISQ_UI_BOX_FLAG_FLEX_ROW) {
-		if (height > box->parent->flex_size)
-			box->parent->flex_size = height;
+	isq_ui_key_stack_count--;
+	return 0;
+}
 
-		if (box->prev_sibling) {
-			position.x = box->prev_sibling->computed_rect.z + box->parent->style.flex_gap;
+struct isq_ui_state isq_ui_state_of(isq_ui_key key)
+{
+	isq_ui_key seed = isq_ui_key_stack_count ? isq_ui_key_stack[isq_ui_key_stack_count - 1] : 0;
+	key = isq_ui_key_combine(seed, key);
 
-			if (position.x >= box->parent->computed_rect.z) {
-				position.x = box->parent->computed_rect.x;
-				box->parent->flex_count += 1;
-			}
+	struct isq_ui_state state = { .id = ISQ_UI_ID_NONE, .key = key };
 
-			position.y += box->parent->flex_count * box->parent->flex_size;
-		}
-	} else if (box->parent && box->parent->flags & ISQ_UI_BOX_FLAG_FLEX_COLUMN) {
-		if (width > box->parent->flex_size)
-			box->parent->flex_size = width;
+	unsigned index = isq_ui_retained_find(key);
+	if (index == ISQ_UI_RETAINED_NONE)
+		return state;
 
-		if (box->prev_sibling) {
-			position.y = box->prev_sibling->computed_rect.w + box->parent->style.flex_gap;
+	struct isq_ui_retained *retained = &isq_ui_retained_array[index];
+	state.id = retained->last_id;
+	state.hovered = retained->hovered;
+	state.clicked = retained->clicked;
 
-			if (position.y >= box->parent->computed_rect.w && !(box->parent->flags & ISQ_UI_BOX_FLAG_FLEX_NOWRAP)) {
-				position.y = box->parent->computed_rect.y;
-				box->parent->flex_count += 1;
-			}
+	return state;
+}
 
-			position.x += box->parent->flex_count * box->parent->flex_size;
-		}
-	}
+// Append the box to the children of parent_id,
+// or to the roots for ISQ_UI_ID_NONE.
+static void isq_ui_box_link(unsigned id, unsigned parent_id)
+{
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	struct isq_ui_box *parent = isq_ui_box_array_get(parent_id);
+	unsigned *first = parent ? &parent->first_child : &isq_ui_root_first;
+	unsigned *last = parent ? &parent->last_child : &isq_ui_root_last;
 
+	isq_ui_box_parent_array[id] = parent_id;
+	box->keyed_ancestor = parent && (parent->retained != ISQ_UI_RETAINED_NONE || parent->keyed_ancestor);
+	box->prev_sibling = *last;
+	box->next_sibling = ISQ_UI_ID_NONE;
 
-	// TODO: Add other types of position... (percentage based, for example)
-	box->computed_rect.x = position.x;
-	box->computed_rect.y = position.y;
+	if (*last != ISQ_UI_ID_NONE)
+		isq_ui_box_array[*last].next_sibling = id;
+	else
+		*first = id;
 
-	box->computed_rect.z = box->computed_rect.x + width - box->style.padding.left - box->style.padding.right;
-	box->computed_rect.w = box->computed_rect.y + height - box->style.padding.top - box->style.padding.bottom;
+	*last = id;
 }
 
-void isq_ui_init(float width, float height, struct isq_ui_style *style)
+static void isq_ui_box_unlink(unsigned id)
 {
-	isq_ui_dimensions.x = width;
-	isq_ui_dimensions.y = height;
+	struct isq_ui_box *box = &isq_ui_box_array[id];
+	struct isq_ui_box *parent = isq_ui_box_array_get(isq_ui_box_parent_array[id]);
+	unsigned *first = parent ? &parent->first_child : &isq_ui_root_first;
+	unsigned *last = parent ? &parent->last_child : &isq_ui_root_last;
 
-	isq_ui_style = *style;
+	if (box->prev_sibling != ISQ_UI_ID_NONE)
+		isq_ui_box_array[box->prev_sibling].next_sibling = box->next_sibling;
+	else
+		*first = box->next_sibling;
 
-	isq_ui_box_array = ISQ_MALLOC(sizeof(struct isq_ui_box) * ISQ_UI_INITIAL_BUFFER_CAPACITY);
-	isq_ui_box_array_capacity = ISQ_UI_INITIAL_BUFFER_CAPACITY;
-	isq_ui_vertex_buffer = ISQ_MALLOC(sizeof(struct isq_ui_vertex) * ISQ_UI_INITIAL_BUFFER_CAPACITY);
-	isq_ui_vertex_buffer_capacity = ISQ_UI_INITIAL_BUFFER_CAPACITY;
+	if (box->next_sibling != ISQ_UI_ID_NONE)
+		isq_ui_box_array[box->next_sibling].prev_sibling = box->prev_sibling;
+	else
+		*last = box->prev_sibling;
 
-	memset(isq_ui_box_array, 0, sizeof(struct isq_ui_box) * ISQ_UI_INITIAL_BUFFER_CAPACITY);
+	isq_ui_box_parent_array[id] = ISQ_UI_ID_NONE;
+	box->prev_sibling = ISQ_UI_ID_NONE;
+	box->next_sibling = ISQ_UI_ID_NONE;
 }
 
-void isq_ui_begin(float mouse_x, float mouse_y, int left_down, float scroll_delta)
+static void isq_ui_box_reparent(unsigned id, unsigned parent_id)
 {
-	isq_ui_mouse.position.x = mouse_x;
-	isq_ui_mouse.position.y = mouse_y;
-	isq_ui_mouse.left_down = left_down;
-	isq_ui_mouse.scroll_delta = scroll_delta;
-
-	isq_ui_current_parent = NULL;
-	isq_ui_box_array_count = 0;
-	isq_ui_vertex_buffer_count = 0;
-}
+	if (isq_ui_box_parent_array[id] == parent_id)
+		return;
 
-void isq_ui_end(void)
-{
-	isq_ui_render();
+	isq_ui_box_unlink(id);
+	isq_ui_box_link(id, parent_id);
 }
 
 unsigned isq_ui_push(void)
 {
-	struct isq_ui_box *box = isq_ui_box_array_get(isq_ui_box_array_count - 1);
-	if (box == NULL)
+	unsigned id = isq_ui_box_array_count - 1;
+	if (isq_ui_box_array_get(id) == NULL)
 		return 1;
 
-	box->parent = isq_ui_current_parent;
-	isq_ui_current_parent = box;
+	isq_ui_box_reparent(id, isq_ui_current_parent);
+	isq_ui_current_parent = id;
 
 	return 0;
 }
 
 unsigned isq_ui_push_id(unsigned id)
 {
-	if (isq_ui_current_parent == NULL) {
-		isq_ui_current_parent = isq_ui_box_array_get(id);
+	if (isq_ui_current_parent == ISQ_UI_ID_NONE) {
+		isq_ui_current_parent = id;
 		return 0;
 	}
 
-	struct isq_ui_box *parent = isq_ui_current_parent;
-	struct isq_ui_box *child = isq_ui_box_array_get(id);
-	if (parent == NULL || child == NULL)
+	if (isq_ui_box_array_get(id) == NULL)
 		return 1;
 
-	child->parent = parent;
-	isq_ui_current_parent = child;
+	isq_ui_box_reparent(id, isq_ui_current_parent);
+	isq_ui_current_parent = id;
 
 	return 0;
 }
 
 unsigned isq_ui_pop(void)
 {
-	if (isq_ui_current_parent == NULL)
+	if (isq_ui_box_array_get(isq_ui_current_parent) == NULL)
 		return 1;
 
-	isq_ui_current_parent = isq_ui_current_parent->parent;
+	isq_ui_current_parent = isq_ui_box_parent_array[isq_ui_current_parent];
 
 	return 0;
 }
 
 unsigned isq_ui_pop_all(void)
 {
-	isq_ui_current_parent = NULL;
+	isq_ui_current_parent = ISQ_UI_ID_NONE;
 	return 0;
 }
 
-static struct isq_ui_box *prev_sibling(unsigned id)
-{
-	if (id == 0)
-		return NULL;
-
-	struct isq_ui_box *curr = isq_ui_box_array_get(id - 1);
-	for (unsigned i = id - 1; i > 0; --i) {
-		struct isq_ui_box *curr = isq_ui_box_array_get(i);
-		if (curr->parent == isq_ui_current_parent)
-			return curr;
-	}
-
-	return NULL;
-}
 
-struct isq_ui_state isq_ui_create(enum isq_ui_box_flags flags)
+static unsigned isq_ui_create_box(enum isq_ui_box_flags flags)
 {
-	// Expand the box array if needed.
-	if (isq_ui_box_array_count == isq_ui_box_array_capacity) {
-		isq_ui_box_array_capacity *= 2;
-		isq_ui_box_array = ISQ_REALLOC(isq_ui_box_array, sizeof(struct isq_ui_box) * isq_ui_box_array_capacity);
-	}
+	isq_ui_box_array_reserve();
 
 	unsigned index = isq_ui_box_array_count;
 	struct isq_ui_box *box = &isq_ui_box_array[index];
@@ -779,41 +4459,79 @@ struct isq_ui_state isq_ui_create(enum isq_ui_box_flags flags)
 	// uninitialized values.
 	box->position = (isq_vec2){ ISQ_UI_MAGIC_NUMBERF, ISQ_UI_MAGIC_NUMBERF };
 
-	box->style.background_color = isq_ui_style.box.background_color;
-	box->style.border_color = isq_ui_style.box.border_color;
-	box->style.padding = isq_ui_style.box.padding;
-	box->style.text_color = isq_ui_style.box.text_color;
-	box->style.border_radius = isq_ui_style.box.border_radius;
-	box->style.border_width = isq_ui_style.box.border_width;
-	box->style.font.character_data = isq_ui_style.box.font.character_data;
-	box->style.font.size = isq_ui_style.box.font.size;
-	box->style.font.texture_index = isq_ui_style.box.font.texture_index;
-	box->style.flex_gap = isq_ui_style.box.flex_gap;
-
-	box->semantic_size = (union isq_ui_sizes){
+	box->style = isq_ui_style.box;
+
+	isq_ui_box_size_array[index] = (union isq_ui_sizes){
 		.x = { .type = ISQ_UI_SIZE_TYPE_NULL, .value = 0 },
 		.y = { .type = ISQ_UI_SIZE_TYPE_NULL, .value = 0 },
 	};
 
-	box->flags = flags;
-	box->parent = isq_ui_current_parent;
-
-	box->first_child = NULL;
+	isq_ui_box_flags_array[index] = flags;
 
-	box->prev_sibling = prev_sibling(index);
-	if (box->prev_sibling) {
-		box->prev_sibling->next_sibling = box;
-	}
-
-	box->last_child = NULL;
+	box->first_child = ISQ_UI_ID_NONE;
+	box->last_child = ISQ_UI_ID_NONE;
+	isq_ui_box_link(index, isq_ui_current_parent);
 
 	box->flex_size = 0;
 	box->flex_count = 0;
+	box->children_size = (isq_vec2){0};
+	box->subtree_count = 1;
+	box->subtree_end = index + 1;
+	box->subtree_hash = 0;
+	box->subtree_key = 0;
+	box->layout_template = 0;
+	box->scroll_height = 0;
+	box->on_interact = NULL;
+	box->on_interact_user = NULL;
 	box->text = NULL;
 
+	box->key = 0;
+	box->retained = ISQ_UI_RETAINED_NONE;
+
 	isq_ui_box_array_count++;
 
-	return isq_ui_interact(index);
+	return index;
+}
+
+struct isq_ui_state isq_ui_create(enum isq_ui_box_flags flags)
+{
+	unsigned id = isq_ui_create_box(flags);
+	return isq_ui_interact(id, id);
+}
+
+struct isq_ui_state isq_ui_create_keyed(enum isq_ui_box_flags flags, isq_ui_key key)
+{
+	isq_ui_key seed = isq_ui_key_stack_count ? isq_ui_key_stack[isq_ui_key_stack_count - 1] : 0;
+	key = isq_ui_key_combine(seed, key);
+
+	unsigned index = isq_ui_retained_find(key);
+	if (index == ISQ_UI_RETAINED_NONE)
+		index = isq_ui_retained_insert(key);
+	else if (isq_ui_retained_array[index].last_frame == isq_ui_frame)
+		return isq_ui_create(flags);
+
+	struct isq_ui_retained *retained = &isq_ui_retained_array[index];
+	unsigned last_id = retained->last_frame == isq_ui_frame - 1 ? retained->last_id : ISQ_UI_ID_NONE;
+	retained->last_frame = isq_ui_frame;
+
+	// Start from this key's rect and scroll state
+	// rather than whatever was in the slot.
+	isq_ui_box_array_reserve();
+
+	struct isq_ui_box *box = &isq_ui_box_array[isq_ui_box_array_count];
+	isq_ui_box_rect_array[isq_ui_box_array_count] = retained->computed_rect;
+	box->scroll_offset = retained->scroll_offset;
+	box->scroll_offset_max = retained->scroll_offset_max;
+
+	unsigned id = isq_ui_create_box(flags);
+
+	box = isq_ui_box_array_get(id);
+	box->key = key;
+	box->retained = index;
+
+	struct isq_ui_state state = isq_ui_interact(id, last_id);
+	state.key = key;
+	return state;
 }
 
 unsigned isq_ui_flags(unsigned id, enum isq_ui_box_flags flags)
@@ -821,7 +4539,7 @@ unsigned isq_ui_flags(unsigned id, enum isq_ui_box_flags flags)
 	struct isq_ui_box *box = isq_ui_box_array_get(id);
 
 	if (box) {
-		box->flags = flags;
+		isq_ui_box_flags_array[id] = flags;
 		return 0;
 	}
 
@@ -833,7 +4551,7 @@ unsigned isq_ui_flags_add(unsigned id, enum isq_ui_box_flags flags)
 	struct isq_ui_box *box = isq_ui_box_array_get(id);
 
 	if (box) {
-		box->flags = flags | box->flags;
+		isq_ui_box_flags_array[id] |= flags;
 		return 0;
 	}
 
@@ -845,7 +4563,7 @@ unsigned isq_ui_flags_remove(unsigned id, enum isq_ui_box_flags flags)
 	struct isq_ui_box *box = isq_ui_box_array_get(id);
 
 	if (box) {
-		box->flags = ~flags & box->flags;
+		isq_ui_box_flags_array[id] &= ~flags;
 		return 0;
 	}
 
@@ -858,8 +4576,8 @@ unsigned isq_ui_semantic_size(unsigned id, union isq_ui_sizes semantic_size)
 	if (!box)
 		return 1;
 
-	box->semantic_size = semantic_size;
-	isq_ui_compute_rect(id);
+	isq_ui_box_size_array[id] = semantic_size;
+	isq_ui_relayout(id);
 	return 0;
 }
 
@@ -869,11 +4587,11 @@ unsigned isq_ui_size(unsigned id, float w, float h)
 	if (!box)
 		return 1;
 
-	box->semantic_size = (union isq_ui_sizes){
+	isq_ui_box_size_array[id] = (union isq_ui_sizes){
 		.x = { .value = w, .type = ISQ_UI_SIZE_TYPE_PIXELS },
 		.y = { .value = h, .type = ISQ_UI_SIZE_TYPE_PIXELS },
 	};
-	isq_ui_compute_rect(id);
+	isq_ui_relayout(id);
 	return 0;
 }
 
@@ -884,7 +4602,7 @@ unsigned isq_ui_position(unsigned id, float x, float y)
 		return 1;
 
 	box->position = (isq_vec2){ x, y };
-	isq_ui_compute_rect(id);
+	isq_ui_relayout(id);
 	return 0;
 }
 
@@ -916,7 +4634,7 @@ unsigned isq_ui_padding(unsigned id, float top, float right, float bottom, float
 		return 1;
 
 	box->style.padding = (isq_vec4){ top, right, bottom, left };
-	isq_ui_compute_rect(id);
+	isq_ui_relayout(id);
 	return 0;
 }
 
@@ -926,14 +4644,37 @@ unsigned isq_ui_parent(unsigned id, unsigned parent_id)
 	if (!box)
 		return 1;
 
-	if (parent_id == -1) {
-		box->parent = NULL;
+	if (parent_id == ISQ_UI_ID_NONE) {
+		isq_ui_box_reparent(id, ISQ_UI_ID_NONE);
 		return 0;
 	}
 
-	struct isq_ui_box *parent = isq_ui_box_array_get(parent_id);
+	if (isq_ui_box_array_get(parent_id) == NULL)
+		return 1;
+
+	isq_ui_box_reparent(id, parent_id);
+	return 0;
+}
+
+unsigned isq_ui_font_glyphs(unsigned id, struct isq_ui_glyph_table *glyphs)
+{
+	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	if (!box)
+		return 1;
+
+	box->style.font.glyphs = glyphs;
+
+	return 0;
+}
+
+unsigned isq_ui_font_atlas(unsigned id, struct isq_ui_atlas *atlas)
+{
+	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	if (!box)
+		return 1;
+
+	box->style.font.atlas = atlas;
 
-	box->parent = parent;
 	return 0;
 }
 
@@ -964,6 +4705,69 @@ unsigned isq_ui_last_id(void)
 	return isq_ui_box_array_count - 1;
 }
 
+unsigned isq_ui_on_interact(unsigned id, isq_ui_interact_callback callback, void *user)
+{
+	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	if (!box)
+		return 1;
+
+	box->on_interact = callback;
+	box->on_interact_user = user;
+
+	return 0;
+}
+
+unsigned isq_ui_layout_template(unsigned id, isq_ui_key key)
+{
+	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	if (!box)
+		return 1;
+
+	box->layout_template = key;
+
+	return 0;
+}
+
+int isq_ui_frame_unchanged(void)
+{
+#ifdef ISQ_UI_UNCHANGED_FRAMES
+	return isq_ui_render_unchanged;
+#else
+	return 0;
+#endif
+}
+
+const struct isq_ui_dirty_range *isq_ui_dirty_ranges(unsigned *count)
+{
+#ifdef ISQ_UI_DIRTY_RANGES
+	*count = isq_ui_dirty_range_count;
+	return isq_ui_dirty_range_buffer;
+#else
+	*count = 0;
+	return NULL;
+#endif
+}
+
+void isq_ui_get_stats(struct isq_ui_stats *stats)
+{
+	*stats = isq_ui_stats;
+	for (unsigned i = 0; i < ISQ_UI_SIZE_CACHE_STRIPES; ++i) {
+		stats->size_cache_hits += isq_ui_size_cache_stripes[i].hits;
+		stats->size_cache_misses += isq_ui_size_cache_stripes[i].misses;
+		stats->text_measure_hits += isq_ui_text_measure_stripes[i].hits;
+		stats->text_measure_misses += isq_ui_text_measure_stripes[i].misses;
+	}
+	stats->wrap_hits = isq_ui_wrap_hits;
+	stats->wrap_misses = isq_ui_wrap_misses;
+	stats->wrap_paragraphs = isq_ui_wrap_paragraphs;
+}
+
+void isq_ui_warm_text(struct isq_ui_font font, const char **texts, unsigned count)
+{
+	for (unsigned i = 0; i < count; ++i)
+		isq_ui_measure_text(font, texts[i]);
+}
+
 struct isq_ui_state isq_ui_flexbox(enum isq_ui_box_flags flags)
 {
 	enum isq_ui_box_flags flex_direction = (flags & ISQ_UI_BOX_FLAG_FLEX_COLUMN) ? ISQ_UI_BOX_FLAG_FLEX_COLUMN : ISQ_UI_BOX_FLAG_FLEX_ROW;
@@ -1018,7 +4822,7 @@ struct isq_ui_state isq_ui_button(const char *text)
 
 struct isq_ui_state isq_ui_text_display(const char *text)
 {
-	struct isq_ui_state state = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND | ISQ_UI_BOX_FLAG_DRAW_BORDER);
+	struct isq_ui_state state = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND | ISQ_UI_BOX_FLAG_DRAW_BORDER | ISQ_UI_BOX_FLAG_TEXT_WRAP_WORD);
 
 	isq_ui_text(state.id, text);
 	isq_ui_position(state.id, 0, 0);
@@ -1033,14 +4837,276 @@ struct isq_ui_state isq_ui_text_display(const char *text)
 	return state;
 }
 
+unsigned isq_ui_virtual_list(unsigned id, unsigned row_count, float row_height, isq_ui_row_callback callback, void *user)
+{
+	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	if (!box || row_height <= 0)
+		return 1;
+
+	// Boxes created with the scroll flag have
+	// already scrolled in isq_ui_interact.
+	int scrolled = isq_ui_box_flags_array[id] & ISQ_UI_BOX_FLAG_SCROLL_VERTICAL;
+
+	float pitch = row_height + box->style.flex_gap;
+	box->scroll_height = row_count ? row_count * pitch - box->style.flex_gap : 0;
+	isq_ui_flags_add(id, ISQ_UI_BOX_FLAG_SCROLL_VERTICAL | ISQ_UI_BOX_FLAG_FLEX_COLUMN | ISQ_UI_BOX_FLAG_FLEX_NOWRAP);
+	isq_ui_relayout(id);
+
+	if (!scrolled)
+		isq_ui_scroll(id);
+
+	// Keyed boxes start with last frame's rect, so
+	// this is only a guess for unkeyed boxes or the
+	// first frame.
+	isq_vec4 rect = isq_ui_box_rect_array[id];
+	float visible = rect.w - rect.y;
+	if (visible <= 0)
+		visible = isq_ui_dimensions.y;
+
+	unsigned first = (unsigned)(box->scroll_offset / pitch);
+	unsigned end = first + (unsigned)(visible / pitch) + 2;
+	if (first > row_count)
+		first = row_count;
+	if (end > row_count)
+		end = row_count;
+
+	isq_ui_push_id(id);
+	isq_ui_push_key(box->key);
+
+	// Holds the place of the rows before first.
+	if (first > 0) {
+		unsigned spacer = isq_ui_box(0).id;
+		isq_ui_size(spacer, 0, first * pitch - box->style.flex_gap);
+	}
+
+	for (unsigned row = first; row < end; ++row) {
+		unsigned row_id = isq_ui_create_keyed(0, isq_ui_key_int(row)).id;
+		isq_ui_position(row_id, 0, 0);
+		isq_ui_semantic_size(row_id, (union isq_ui_sizes){
+			.x = { .type = ISQ_UI_SIZE_TYPE_PERCENT, .value = 1 },
+			.y = { .type = ISQ_UI_SIZE_TYPE_PIXELS, .value = row_height },
+		});
+
+		isq_ui_push_id(row_id);
+		callback(row, row_id, user);
+		isq_ui_pop();
+	}
+
+	isq_ui_pop_key();
+	isq_ui_pop();
+
+	return 0;
+}
+
+// Make room for length more bytes of the open
+// line plus its terminator, moving the line to a
+// new chunk if the current one is full.
+static void isq_ui_log_reserve(struct isq_ui_log *log, unsigned length)
+{
+	struct isq_ui_log_chunk *chunk = log->chunk_count ? &log->chunks[log->chunk_count - 1] : NULL;
+	if (chunk && chunk->used + length + 1 <= chunk->size)
+		return;
+
+	struct isq_ui_log_line *line = log->line_open ? &log->lines[log->line_count - 1] : NULL;
+	unsigned partial = line ? chunk->used - line->offset : 0;
+
+	if (log->chunk_count == log->chunk_capacity) {
+		log->chunk_capacity = log->chunk_capacity ? log->chunk_capacity * 2 : 16;
+		log->chunks = ISQ_REALLOC(log->chunks, sizeof(struct isq_ui_log_chunk) * log->chunk_capacity);
+	}
+
+	unsigned size = ISQ_UI_LOG_CHUNK_SIZE;
+	if (size < (partial + length + 1) * 2)
+		size = (partial + length + 1) * 2;
+
+	struct isq_ui_log_chunk *next = &log->chunks[log->chunk_count++];
+	next->data = ISQ_MALLOC(size);
+	next->size = size;
+	next->used = 0;
+
+	// The old copy stays behind, so text handed
+	// out this frame stays valid.
+	if (line) {
+		chunk = &log->chunks[log->chunk_count - 2];
+		memcpy(next->data, chunk->data + line->offset, partial);
+		next->used = partial;
+		line->chunk = log->chunk_count - 1;
+		line->offset = 0;
+	}
+}
+
+void isq_ui_log_append(struct isq_ui_log *log, const char *text, unsigned length)
+{
+	while (length) {
+		const char *newline = memchr(text, '\n', length);
+		unsigned count = newline ? (unsigned)(newline - text) : length;
+
+		isq_ui_log_reserve(log, count);
+		struct isq_ui_log_chunk *chunk = &log->chunks[log->chunk_count - 1];
+
+		if (!log->line_open) {
+			if (log->line_count == log->line_capacity) {
+				log->line_capacity = log->line_capacity ? log->line_capacity * 2 : 1024;
+				log->lines = ISQ_REALLOC(log->lines, sizeof(struct isq_ui_log_line) * log->line_capacity);
+			}
+
+			log->lines[log->line_count++] = (struct isq_ui_log_line){ log->chunk_count - 1, chunk->used };
+			log->line_open = 1;
+		}
+
+		memcpy(chunk->data + chunk->used, text, count);
+		chunk->used += count;
+		chunk->data[chunk->used] = 0;
+
+		if (newline) {
+			// Keep the terminator.
+			chunk->used++;
+			log->line_open = 0;
+			count++;
+		}
+
+		text += count;
+		length -= count;
+	}
+}
+
+const char *isq_ui_log_line(const struct isq_ui_log *log, unsigned line)
+{
+	if (line >= log->line_count)
+		return NULL;
+
+	return log->chunks[log->lines[line].chunk].data + log->lines[line].offset;
+}
+
+void isq_ui_log_free(struct isq_ui_log *log)
+{
+	for (unsigned i = 0; i < log->chunk_count; ++i)
+		ISQ_FREE(log->chunks[i].data);
+	ISQ_FREE(log->chunks);
+	ISQ_FREE(log->lines);
+	*log = (struct isq_ui_log){0};
+}
+
+static void isq_ui_log_row(unsigned row, unsigned id, void *user)
+{
+	isq_ui_text(id, isq_ui_log_line(user, row));
+}
+
+unsigned isq_ui_log_view(unsigned id, struct isq_ui_log *log)
+{
+	struct isq_ui_box *box = isq_ui_box_array_get(id);
+	if (!box)
+		return 1;
+
+	float row_height = box->style.font.size > 0 ? box->style.font.size : 1;
+	float height = log->line_count ? log->line_count * (row_height + box->style.flex_gap) - box->style.flex_gap : 0;
+	float visible = isq_ui_box_rect_array[id].w - isq_ui_box_rect_array[id].y;
+
+	// Stay at the end while it grows, as long as the
+	// view was at the end last frame. Layout has
+	// already replaced scroll_offset_max, so last
+	// frame's comes from the retained entry.
+	if (box->retained != ISQ_UI_RETAINED_NONE) {
+		float last_max = isq_ui_retained_array[box->retained].scroll_offset_max;
+		if (box->scroll_offset >= last_max && height > visible && visible > 0)
+			box->scroll_offset = height - visible;
+	}
+
+	return isq_ui_virtual_list(id, log->line_count, row_height, isq_ui_log_row, log);
+}
+
+unsigned isq_ui_glyph_table_add(struct isq_ui_glyph_table *table, unsigned first_codepoint, unsigned count, unsigned first_glyph)
+{
+	if (first_codepoint > 0x10ffff || count > 0x110000 - first_codepoint)
+		return 1;
+
+	for (unsigned i = 0; i < count; ++i) {
+		unsigned codepoint = first_codepoint + i;
+		unsigned **page = &table->pages[codepoint >> 8];
+
+		if (!*page) {
+			*page = ISQ_MALLOC(sizeof(unsigned) * 256);
+			memset(*page, 0xff, sizeof(unsigned) * 256);
+		}
+
+		(*page)[codepoint & 0xff] = first_glyph + i;
+	}
+
+	return 0;
+}
+
+void isq_ui_glyph_table_free(struct isq_ui_glyph_table *table)
+{
+	for (unsigned i = 0; i < sizeof(table->pages) / sizeof(table->pages[0]); ++i)
+		ISQ_FREE(table->pages[i]);
+	memset(table, 0, sizeof(*table));
+}
+
+unsigned isq_ui_atlas_init(struct isq_ui_atlas *atlas, unsigned page_size, unsigned max_pages, unsigned first_texture_index, isq_ui_rasterize_callback rasterize, void *user)
+{
+	if (!page_size || !max_pages || max_pages > 32 || !rasterize)
+		return 1;
+
+	memset(atlas, 0, sizeof(*atlas));
+	atlas->page_size = page_size;
+	atlas->max_pages = max_pages;
+	atlas->first_texture_index = first_texture_index;
+	atlas->rasterize = rasterize;
+	atlas->user = user;
+	atlas->pages = ISQ_CALLOC(max_pages, sizeof(struct isq_ui_atlas_page));
+
+	return 0;
+}
+
+unsigned isq_ui_atlas_sdf(struct isq_ui_atlas *atlas, float reference_size, unsigned spread)
+{
+	if (atlas->glyph_count || reference_size <= 0 || !spread)
+		return 1;
+
+	atlas->sdf_size = reference_size;
+	atlas->sdf_spread = spread;
+
+	return 0;
+}
+
+void isq_ui_atlas_free(struct isq_ui_atlas *atlas)
+{
+	// Runs drawn from the atlas point at its pages.
+	isq_ui_glyph_run_drop(atlas, ~0u);
+
+	for (unsigned i = 0; i < atlas->page_count; ++i) {
+		ISQ_FREE(atlas->pages[i].pixels);
+		ISQ_FREE(atlas->pages[i].nodes);
+	}
+	ISQ_FREE(atlas->pages);
+	ISQ_FREE(atlas->glyphs);
+	ISQ_FREE(atlas->slots);
+	memset(atlas, 0, sizeof(*atlas));
+}
+
+int isq_ui_atlas_dirty(struct isq_ui_atlas *atlas, unsigned page, unsigned rect[4])
+{
+	if (page >= atlas->page_count)
+		return 0;
+
+	unsigned *dirty = atlas->pages[page].dirty;
+	if (dirty[0] == dirty[2])
+		return 0;
+
+	memcpy(rect, dirty, sizeof(unsigned) * 4);
+	memset(dirty, 0, sizeof(unsigned) * 4);
+	return 1;
+}
+
 void isq_ui_get_size(unsigned id, float *width, float *height)
 {
 	struct isq_ui_box *box = isq_ui_box_array_get(id);
 	if (!box)
 		return;
 
-	*width = box->computed_rect.z - box->computed_rect.x;
-	*height = box->computed_rect.w - box->computed_rect.y;
+	isq_vec4 rect = isq_ui_box_rect_array[id];
+	*width = rect.z - rect.x;
+	*height = rect.w - rect.y;
 }
 
 void isq_ui_get_position(unsigned id, float *x, float *y)
@@ -1049,8 +5115,8 @@ void isq_ui_get_position(unsigned id, float *x, float *y)
 	if (!box)
 		return;
 
-	*x = box->computed_rect.x;
-	*y = box->computed_rect.y;
+	*x = isq_ui_box_rect_array[id].x;
+	*y = isq_ui_box_rect_array[id].y;
 }
 
 #endif
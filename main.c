@@ -6,9 +6,31 @@
 #define RED (f32[4]){1, 0, 0, 1}
 #define GREEN (f32[4]){0, 1, 0, 1}
 
-void rect_render(void *, size_t);
-
-#define ISQ_UI_RECT_RENDER(buffer, count) rect_render(buffer, count)
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "stb_truetype.h"
+
+struct isq_ui_command;
+void rect_render(struct isq_ui_command *, size_t, void *, size_t);
+void *rect_ring_map(size_t);
+
+#define ISQ_UI_BAKED_QUAD_TYPE stbtt_aligned_quad
+#define ISQ_UI_BAKED_QUAD(data, w, h, c, x, y, q, fill) stbtt_GetBakedQuad(data, w, h, c, x, y, q, fill)
+#define ISQ_UI_RENDER_COMMANDS(commands, command_count, buffer, count) rect_render(commands, command_count, buffer, count)
+// Uncomment to send one 32 byte instance per rect
+// and expand it in rect_instance.vert.
+//#define ISQ_UI_INSTANCES
+// Or this one for 16 byte quantized vertices.
+//#define ISQ_UI_COMPACT_VERTICES
+// Vertices are written straight into a ring of
+// mapped buffer regions. Uncomment to upload only
+// the parts of one buffer that changed instead.
+//#define ISQ_UI_DIRTY_RANGES
+#ifndef ISQ_UI_DIRTY_RANGES
+#define ISQ_UI_MAP_VERTICES(count) rect_ring_map(count)
+#endif
+// Skip drawing frames that look the same as the
+// last one.
+#define ISQ_UI_UNCHANGED_FRAMES
 #define ISQ_UI_IMPLEMENTATION
 #include "isq_ui.h"
 
@@ -111,6 +133,18 @@ u32 rect_vao;
 u32 rect_vbo;
 u32 rect_ebo;
 
+// One page of signed distance field glyphs shared
+// by every font size, drawn as texture index 1.
+enum {
+	ATLAS_PAGE_SIZE = 1024,
+	ATLAS_REFERENCE_SIZE = 32,
+	ATLAS_SPREAD = 4,
+};
+
+stbtt_fontinfo font_info;
+struct isq_ui_atlas font_atlas;
+u32 font_texture;
+
 vec2 mouse_position;
 
 enum {
@@ -119,6 +153,53 @@ enum {
 	INDEX_COUNT = MAX_RECT_COUNT * 6,
 };
 
+// Elements of one frame's vertex buffer.
+enum {
+#ifdef ISQ_UI_INSTANCES
+	RECT_BUFFER_COUNT = MAX_RECT_COUNT,
+#else
+	RECT_BUFFER_COUNT = MAX_VERTEX_COUNT,
+#endif
+	RECT_BUFFER_SIZE = RECT_BUFFER_COUNT * sizeof(isq_ui_render_vertex),
+};
+
+// Time spent uploading vertices, either waiting
+// for the GPU to finish with a region or in the
+// driver, printed about once a second.
+struct {
+	f64 frame_stall;
+	f64 stall_time;
+	f64 stall_max;
+	u32 frames;
+} upload_stats;
+
+#ifndef ISQ_UI_DIRTY_RANGES
+// The GPU may still be drawing the last two
+// frames while the CPU writes the next one.
+enum {
+	RING_FRAMES = 3,
+};
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// Only loaded with GL_ARB_buffer_storage, the
+// loader is for GL 3.3.
+typedef void (APIENTRYP rect_buffer_storage_proc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+struct {
+	// Mapped for the life of the buffer, or NULL
+	// when the buffer is orphaned every frame.
+	u8 *persistent;
+	GLsync fences[RING_FRAMES];
+	u32 region;
+	// Where this frame's vertices go.
+	void *current;
+} rect_ring;
+#endif
+
 static char *buffer_from_file(const char *path)
 {
 	FILE *file = fopen(path, "rb");
@@ -190,17 +271,232 @@ static u32 shader_create(const char *vert_path, const char *frag_path)
 	return shader;
 }
 
-void rect_render(void *buffer, usize count)
+static void font_rasterize(void *font, unsigned codepoint, float size, struct isq_ui_glyph_metrics *metrics, unsigned char *pixels, int stride, void *user)
 {
-	// TODO: DELETE THIS
-	struct isq_ui_vertex *v = (struct isq_ui_vertex*)buffer;
+	stbtt_fontinfo *info = font;
 
+	// No font.ttf, draw nothing.
+	if (!info->data)
+		return;
+
+	f32 scale = stbtt_ScaleForPixelHeight(info, size);
+
+	if (pixels) {
+		stbtt_MakeCodepointBitmap(info, pixels, metrics->width, metrics->height, stride, scale, scale, (int)codepoint);
+		return;
+	}
+
+	int advance, x0, y0, x1, y1;
+	stbtt_GetCodepointHMetrics(info, (int)codepoint, &advance, NULL);
+	stbtt_GetCodepointBitmapBox(info, (int)codepoint, scale, scale, &x0, &y0, &x1, &y1);
+
+	metrics->width = x1 - x0;
+	metrics->height = y1 - y0;
+	metrics->x_offset = (f32)x0;
+	metrics->y_offset = (f32)y0;
+	metrics->advance = advance * scale;
+}
+
+// Upload the glyphs added to the atlas since the
+// last frame.
+static void font_upload(void)
+{
+	unsigned rect[4];
+	if (!isq_ui_atlas_dirty(&font_atlas, 0, rect))
+		return;
+
+	glBindTexture(GL_TEXTURE_2D, font_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, ATLAS_PAGE_SIZE);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, rect[0], rect[1], rect[2] - rect[0], rect[3] - rect[1], GL_RED, GL_UNSIGNED_BYTE, font_atlas.pages[0].pixels + rect[1] * ATLAS_PAGE_SIZE + rect[0]);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+static void rect_buffer_init(void)
+{
+	glGenBuffers(1, &rect_vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(struct isq_ui_vertex), buffer);
+
+#ifndef ISQ_UI_DIRTY_RANGES
+	rect_buffer_storage_proc buffer_storage = NULL;
+	if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+		buffer_storage = (rect_buffer_storage_proc)glfwGetProcAddress("glBufferStorage");
+
+	if (buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		buffer_storage(GL_ARRAY_BUFFER, RECT_BUFFER_SIZE * RING_FRAMES, NULL, flags);
+		rect_ring.persistent = glMapBufferRange(GL_ARRAY_BUFFER, 0, RECT_BUFFER_SIZE * RING_FRAMES, flags);
+
+		// Storage is immutable, start over to orphan.
+		if (!rect_ring.persistent) {
+			glDeleteBuffers(1, &rect_vbo);
+			glGenBuffers(1, &rect_vbo);
+			glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
+		}
+	}
+
+	if (!rect_ring.persistent)
+		glBufferData(GL_ARRAY_BUFFER, RECT_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+#else
+	glBufferData(GL_ARRAY_BUFFER, RECT_BUFFER_SIZE, NULL, GL_DYNAMIC_DRAW);
+#endif
+}
+
+#ifndef ISQ_UI_DIRTY_RANGES
+// ISQ_UI_MAP_VERTICES: room for count elements in
+// the next region, which isq_ui writes this
+// frame's vertices into.
+void *rect_ring_map(usize count)
+{
+	if (count > RECT_BUFFER_COUNT)
+		return NULL;
+
+	f64 start = glfwGetTime();
+
+	if (rect_ring.persistent) {
+		rect_ring.region = (rect_ring.region + 1) % RING_FRAMES;
+
+		GLsync fence = rect_ring.fences[rect_ring.region];
+		if (fence) {
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+				;
+			glDeleteSync(fence);
+			rect_ring.fences[rect_ring.region] = NULL;
+		}
+
+		rect_ring.current = rect_ring.persistent + rect_ring.region * RECT_BUFFER_SIZE;
+	} else {
+		// Orphaning gets fresh storage from the driver
+		// instead of waiting on draws using the old.
+		glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
+		glBufferData(GL_ARRAY_BUFFER, RECT_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+		rect_ring.current = glMapBufferRange(GL_ARRAY_BUFFER, 0, count * sizeof(isq_ui_render_vertex), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	}
+
+	upload_stats.frame_stall += glfwGetTime() - start;
+
+	return rect_ring.current;
+}
+#endif
+
+#ifdef ISQ_UI_INSTANCES
+// Point the instance attributes at instance first.
+// GL 3.3 has no base instance to draw from.
+static void rect_instance_attributes(usize first)
+{
+	usize offset = first * sizeof(struct isq_ui_instance);
+	u32 stride = sizeof(struct isq_ui_instance);
+
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (void *)(offset + offsetof(struct isq_ui_instance, rect)));
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void *)(offset + offsetof(struct isq_ui_instance, color)));
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void *)(offset + offsetof(struct isq_ui_instance, uvs)));
+	glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, stride, (void *)(offset + offsetof(struct isq_ui_instance, texture_index)));
+}
+#endif
+
+void rect_render(struct isq_ui_command *commands, usize command_count, void *buffer, usize count)
+{
+	if (count > RECT_BUFFER_COUNT)
+		count = RECT_BUFFER_COUNT;
+
+	// Only cleared when something is drawn, an
+	// unchanged frame keeps the last image.
+	glClearColor(0.2, 0.2, 0.2, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	font_upload();
+
+	glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
+
+	// First element of this frame in the buffer.
+	usize base = 0;
+
+#ifdef ISQ_UI_DIRTY_RANGES
+	f64 start = glfwGetTime();
+
+	// The buffer object keeps last frame's bytes, so
+	// only the ranges that differ are sent again.
+	usize size = count * sizeof(isq_ui_render_vertex);
+	unsigned range_count;
+	const struct isq_ui_dirty_range *ranges = isq_ui_dirty_ranges(&range_count);
+	for (unsigned i = 0; i < range_count; ++i) {
+		if (ranges[i].offset >= size)
+			break;
+
+		usize range_size = ranges[i].size;
+		if (ranges[i].offset + range_size > size)
+			range_size = size - ranges[i].offset;
+		glBufferSubData(GL_ARRAY_BUFFER, ranges[i].offset, range_size, (u8 *)buffer + ranges[i].offset);
+	}
+
+	upload_stats.frame_stall += glfwGetTime() - start;
+#else
+	// More than fits in a region, so isq_ui kept
+	// them. Copy the ones that are drawn.
+	if (count > 0 && buffer != rect_ring.current) {
+		void *mapped = rect_ring_map(count);
+		if (mapped)
+			memcpy(mapped, buffer, count * sizeof(isq_ui_render_vertex));
+		else
+			count = 0;
+	}
+
+	if (!rect_ring.persistent && rect_ring.current)
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+
+	base = rect_ring.region * RECT_BUFFER_COUNT;
+#endif
 
 	glUseProgram(rect_shader);
 	glBindVertexArray(rect_vao);
-	glDrawElements(GL_TRIANGLES, (count / 4) * 6, GL_UNSIGNED_INT, NULL);
+	glActiveTexture(GL_TEXTURE0);
+	glEnable(GL_SCISSOR_TEST);
+
+	// Commands are batched by texture, so this only
+	// changes a few times per frame. Texture index 1
+	// is the font atlas, 0 draws plain rects.
+	u32 bound_texture = (u32)-1;
+
+	for (usize i = 0; i < command_count; ++i) {
+		struct isq_ui_command *command = &commands[i];
+		if (command->first >= count)
+			break;
+
+		u32 vertex_count = command->count;
+		if (command->first + vertex_count > count)
+			vertex_count = count - command->first;
+
+		if (command->texture_index != bound_texture) {
+			bound_texture = command->texture_index;
+			glBindTexture(GL_TEXTURE_2D, bound_texture == 1 ? font_texture : 0);
+		}
+
+		// GL puts the scissor origin at the bottom left.
+		isq_vec4 clip = command->clip;
+		glScissor((int)clip.x, (int)(HEIGHT - clip.w), (int)(clip.z - clip.x), (int)(clip.w - clip.y));
+#ifdef ISQ_UI_INSTANCES
+		rect_instance_attributes(base + command->first);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, vertex_count);
+#else
+		glDrawElementsBaseVertex(GL_TRIANGLES, (vertex_count / 4) * 6, GL_UNSIGNED_INT, (void *)(sizeof(u32) * (command->first / 4) * 6), (int)base);
+#endif
+	}
+
+	glDisable(GL_SCISSOR_TEST);
+
+#ifndef ISQ_UI_DIRTY_RANGES
+	// The region can be written again once the GPU
+	// is past this point.
+	if (rect_ring.persistent && count > 0)
+		rect_ring.fences[rect_ring.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	rect_ring.current = NULL;
+#endif
+
+	upload_stats.stall_time += upload_stats.frame_stall;
+	if (upload_stats.frame_stall > upload_stats.stall_max)
+		upload_stats.stall_max = upload_stats.frame_stall;
+	upload_stats.frame_stall = 0;
+	upload_stats.frames++;
 }
 
 void cursor_callback(GLFWwindow *window, f64 x, f64 y)
@@ -244,11 +540,24 @@ int main(void)
 		return EXIT_FAILURE;
 	}
 
-	rect_shader = shader_create("rect.vert", "rect.frag");
-
 	glGenVertexArrays(1, &rect_vao);
 	glBindVertexArray(rect_vao);
 
+#ifdef ISQ_UI_INSTANCES
+	rect_shader = shader_create("rect_instance.vert", "rect_sdf.frag");
+
+	rect_buffer_init();
+
+	// Every attribute steps once per rect, the 4
+	// corners come from gl_VertexID.
+	for (u32 i = 0; i < 4; ++i) {
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
+	rect_instance_attributes(0);
+#else
+	rect_shader = shader_create("rect.vert", "rect_sdf.frag");
+
 	u32 indices[INDEX_COUNT];
 	for (usize i = 0, offset = 0; i < INDEX_COUNT; i += 6, offset += 4) {
 		indices[i + 0] = 0 + offset;
@@ -259,36 +568,84 @@ int main(void)
 		indices[i + 5] = 0 + offset;
 	}
 
-	glGenBuffers(1, &rect_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(struct isq_ui_vertex) * MAX_VERTEX_COUNT, NULL, GL_DYNAMIC_DRAW);
+	rect_buffer_init();
 
+#ifdef ISQ_UI_COMPACT_VERTICES
+	// Positions stay in subpixels, the projection
+	// scales them back down.
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, sizeof(struct isq_ui_compact_vertex), (void*)offsetof(struct isq_ui_compact_vertex, position));
+
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(struct isq_ui_compact_vertex), (void*)offsetof(struct isq_ui_compact_vertex, color));
+
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(struct isq_ui_compact_vertex), (void*)offsetof(struct isq_ui_compact_vertex, uvs));
+
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(struct isq_ui_compact_vertex), (void*)offsetof(struct isq_ui_compact_vertex, texture_index));
+#else
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct isq_ui_vertex), (void*)offsetof(struct isq_ui_vertex, position));
 
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct isq_ui_vertex), (void*)offsetof(struct isq_ui_vertex, color));
 
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(struct isq_ui_vertex), (void*)offsetof(struct isq_ui_vertex, uvs));
+
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(struct isq_ui_vertex), (void*)offsetof(struct isq_ui_vertex, texture_index));
+#endif
+
 	glGenBuffers(1, &rect_ebo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rect_ebo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+#endif
 
 	glUseProgram(rect_shader);
 
+#ifdef ISQ_UI_COMPACT_VERTICES
+	mat4 projection = mat4_ortho(0, WIDTH * ISQ_UI_COMPACT_SUBPIXELS, HEIGHT * ISQ_UI_COMPACT_SUBPIXELS, 0, -1, 1);
+#else
 	mat4 projection = mat4_ortho(0, WIDTH, HEIGHT, 0, -1, 1);
+#endif
 	glUniformMatrix4fv(glGetUniformLocation(rect_shader, "u_projection"), 1, GL_FALSE, &projection.data[0][0]);
+	glUniform1i(glGetUniformLocation(rect_shader, "u_atlas"), 0);
 
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	vec2 root_pos = { 100, 100 };
 
-	isq_ui_init(WIDTH, HEIGHT);
+	u8 *font_file = (u8 *)buffer_from_file("font.ttf");
+	if (font_file)
+		stbtt_InitFont(&font_info, font_file, 0);
 
-	while (!glfwWindowShouldClose(window)) {
-		glClearColor(0.2, 0.2, 0.2, 1);
-		glClear(GL_COLOR_BUFFER_BIT);
+	isq_ui_atlas_init(&font_atlas, ATLAS_PAGE_SIZE, 1, 1, font_rasterize, NULL);
+	isq_ui_atlas_sdf(&font_atlas, ATLAS_REFERENCE_SIZE, ATLAS_SPREAD);
+
+	glGenTextures(1, &font_texture);
+	glBindTexture(GL_TEXTURE_2D, font_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	struct isq_ui_style style = {0};
+	style.box.font.character_data = &font_info;
+	style.box.font.size = 16;
+	style.box.font.atlas = &font_atlas;
+	style.button = style.box;
+	style.button.background_color = (isq_vec4){ 0, 1, 0, 1 };
+	style.button.text_color = (isq_vec4){ 1, 1, 1, 1 };
+
+	isq_ui_init(WIDTH, HEIGHT, &style);
 
+	f64 report_time = glfwGetTime();
+
+	while (!glfwWindowShouldClose(window)) {
 		if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
 			glfwSetWindowShouldClose(window, GL_TRUE);
 		}
@@ -306,7 +663,7 @@ int main(void)
 			root_pos.y += 0.5;
 		}
 
-		isq_ui_begin(mouse_position.x, mouse_position.y);
+		isq_ui_begin(mouse_position.x, mouse_position.y, glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS, 0);
 
 		u32 id = isq_ui_flexbox(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND).id;
 		isq_ui_position(id, root_pos.x, root_pos.y);
@@ -340,7 +697,7 @@ int main(void)
 #if 1
 			isq_ui_push();
 
-			isq_ui_button("Test", WHITE, GREEN, 0);
+			isq_ui_button("Test");
 
 			isq_ui_pop();
 #endif
@@ -348,6 +705,22 @@ int main(void)
 
 		isq_ui_end();
 
+		if (glfwGetTime() - report_time >= 1 && upload_stats.frames > 0) {
+			printf("upload stall: %.3f ms/frame, max %.3f ms\n", upload_stats.stall_time * 1e3 / upload_stats.frames, upload_stats.stall_max * 1e3);
+			upload_stats.stall_time = 0;
+			upload_stats.stall_max = 0;
+			upload_stats.frames = 0;
+			report_time = glfwGetTime();
+		}
+
+		// Nothing was drawn, so the back buffer doesn't
+		// hold this frame. Sleep until there is input,
+		// or a while has passed.
+		if (isq_ui_frame_unchanged()) {
+			glfwWaitEventsTimeout(0.1);
+			continue;
+		}
+
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
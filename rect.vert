@@ -1,13 +1,19 @@
 #version 330 core
 layout (location = 0) in vec3 a_position;
 layout (location = 1) in vec4 a_color;
+layout (location = 2) in vec2 a_uvs;
+layout (location = 3) in float a_texture_index;
 
 uniform mat4 u_projection;
 
 out vec4 v_color;
+out vec2 v_uvs;
+flat out float v_texture_index;
 
 void main()
 {
 	v_color = a_color;
+	v_uvs = a_uvs;
+	v_texture_index = a_texture_index;
 	gl_Position = u_projection * vec4(a_position, 1);
 }
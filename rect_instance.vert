@@ -0,0 +1,23 @@
+#version 330 core
+layout (location = 0) in vec4 a_rect;
+layout (location = 1) in vec4 a_color;
+layout (location = 2) in vec4 a_uvs;
+layout (location = 3) in uint a_texture_index;
+
+uniform mat4 u_projection;
+
+out vec4 v_color;
+out vec2 v_uvs;
+flat out float v_texture_index;
+
+// One struct isq_ui_instance per rect, drawn as a
+// 4 vertex triangle strip.
+void main()
+{
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+
+	v_color = a_color;
+	v_uvs = mix(a_uvs.xy, a_uvs.zw, corner);
+	v_texture_index = float(a_texture_index);
+	gl_Position = u_projection * vec4(mix(a_rect.xy, a_rect.zw, corner), 0, 1);
+}
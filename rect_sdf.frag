@@ -0,0 +1,27 @@
+#version 330 core
+out vec4 o_color;
+
+in vec4 v_color;
+in vec2 v_uvs;
+flat in float v_texture_index;
+
+// Signed distance field glyphs, see
+// isq_ui_atlas_sdf. Texture index 0 is a plain
+// rect.
+uniform sampler2D u_atlas;
+
+void main()
+{
+	if (v_texture_index < 0.5) {
+		o_color = v_color;
+		return;
+	}
+
+	// 0.5 is the outline. Smooth over about one
+	// screen pixel, whatever size the glyph is
+	// drawn at.
+	float distance = texture(u_atlas, v_uvs).r;
+	float width = length(vec2(dFdx(distance), dFdy(distance))) * 0.7;
+	float alpha = smoothstep(0.5 - width, 0.5 + width, distance);
+	o_color = vec4(v_color.rgb, v_color.a * alpha);
+}
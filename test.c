@@ -0,0 +1,97 @@
+// Tests for isq_ui.h that don't need a window.
+// Glyphs are faked with fixed size quads, like in
+// bench.c. Returns the number of failed checks.
+#include <stdio.h>
+
+typedef struct {
+	float x0, y0, s0, t0;
+	float x1, y1, s1, t1;
+} test_quad;
+
+static void test_baked_quad(float *x, float *y, test_quad *q)
+{
+	q->x0 = *x;
+	q->y0 = *y - 12;
+	q->x1 = *x + 8;
+	q->y1 = *y + 4;
+	q->s0 = q->t0 = 0;
+	q->s1 = q->t1 = 1;
+	*x += 9;
+}
+
+#define ISQ_UI_BAKED_QUAD_TYPE test_quad
+#define ISQ_UI_BAKED_QUAD(data, w, h, c, x, y, q, fill) test_baked_quad(x, y, q)
+#define ISQ_UI_RENDER_RECT(buffer, count) ((void)(buffer), (void)(count))
+#define ISQ_UI_IMPLEMENTATION
+#include "isq_ui.h"
+
+static unsigned test_failures = 0;
+
+#define TEST_CHECK(condition, ...) do { \
+		if (!(condition)) { \
+			printf("%s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			test_failures++; \
+		} \
+	} while (0)
+
+// A keyed scrolling panel, scrolled a bit further
+// every deferred frame. Its children only change
+// in frame 3, so that is laid out while scrolled,
+// and the other frames after the first restore
+// the panel's stored subtree, which must not
+// already be scrolled.
+static void test_scrolled_keyed_subtree(void)
+{
+	isq_ui_layout_mode(ISQ_UI_LAYOUT_DEFERRED);
+
+	for (unsigned frame = 0; frame < 8; ++frame) {
+		isq_ui_begin(0, 0, 0, frame ? -1 : 0);
+
+		unsigned panel = isq_ui_create_keyed(ISQ_UI_BOX_FLAG_SCROLL_VERTICAL | ISQ_UI_BOX_FLAG_FLEX_COLUMN | ISQ_UI_BOX_FLAG_FLEX_NOWRAP, isq_ui_key_string("panel")).id;
+		isq_ui_push();
+		isq_ui_position(panel, 0, 0);
+		isq_ui_size(panel, 200, 200);
+
+		float width = frame < 3 ? 200 : 190;
+		unsigned first = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND).id;
+		isq_ui_size(first, width, 40);
+		for (unsigned i = 1; i < 10; ++i) {
+			unsigned id = isq_ui_box(ISQ_UI_BOX_FLAG_DRAW_BACKGROUND).id;
+			isq_ui_size(id, width, 40);
+		}
+		isq_ui_pop();
+
+		isq_ui_end();
+
+		struct isq_ui_stats stats;
+		isq_ui_get_stats(&stats);
+		if (frame > 0 && frame != 3)
+			TEST_CHECK(stats.subtree_hits == 1, "frame %u: subtree not reused", frame);
+
+		float offset = isq_ui_box_array[panel].scroll_offset;
+		if (frame > 0)
+			TEST_CHECK(offset > 0, "frame %u: panel did not scroll", frame);
+
+		for (unsigned i = 0; i < 10; ++i) {
+			isq_vec4 rect = isq_ui_box_rect_array[first + i];
+			float y = 40.0f * i - offset;
+			TEST_CHECK(rect.y == y && rect.w == y + 40, "frame %u: child %u at y %g, expected %g", frame, i, rect.y, y);
+		}
+	}
+
+	isq_ui_layout_mode(ISQ_UI_LAYOUT_IMMEDIATE);
+}
+
+int main(void)
+{
+	struct isq_ui_style style = {0};
+	style.box.font.size = 16;
+	isq_ui_init(1920, 1080, &style);
+
+	test_scrolled_keyed_subtree();
+
+	printf("%u failed\n", test_failures);
+	return (int)test_failures;
+}